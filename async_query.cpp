@@ -0,0 +1,100 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "async_query.h"
+
+#include <cstdio>
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace mongo;
+
+WorkQueue* io_queue = NULL;
+
+AsyncQuery::AsyncQuery(ConnPool& pool, const Op& op) : _state(new State)
+{
+	if(io_queue == NULL){
+		run(&pool,op,_state);
+		return;
+	}
+
+	//每个查询单独一个key，互不等待
+	char key[32];
+	snprintf(key,sizeof(key),"%p",(void*)_state.get());
+	io_queue->post(key,boost::bind(&AsyncQuery::run,&pool,op,_state));
+}
+
+AsyncQuery::~AsyncQuery()
+{
+	//操作可能仍在写入调用者的结果
+	boost::mutex::scoped_lock lock(_state->mutex);
+	while(!_state->done){
+		_state->done_cond.wait(lock);
+	}
+}
+
+void AsyncQuery::wait()
+{
+	string error;
+	{
+	boost::mutex::scoped_lock lock(_state->mutex);
+	while(!_state->done){
+		_state->done_cond.wait(lock);
+	}
+	error = _state->error;
+	}
+
+	if(!error.empty()){
+		uasserted(17503,error);
+	}
+}
+
+/**
+ * io线程中执行：借出连接执行操作并通知等待者
+ * pool：连接池
+ * op：操作
+ * state：完成状态
+ **/
+void AsyncQuery::run(ConnPool* pool, Op op, boost::shared_ptr<State> state)
+{
+	string error;
+	try{
+		PooledConnection sdc(*pool);
+		op(sdc.conn());
+		sdc.done();
+	}catch(DBException &e){
+		error = e.what();
+		if(error.empty()){
+			error = "async query failed";
+		}
+	}
+
+	boost::mutex::scoped_lock lock(state->mutex);
+	state->error = error;
+	state->done = true;
+	state->done_cond.notify_all();
+}
+
+static void find_one(DBClientBase& conn, const string& ns, const BSONObj& query, BSONObj* result)
+{
+	*result = conn.findOne(ns,query).getOwned();
+}
+
+AsyncQuery::Op find_one_op(const string& ns, const BSONObj& query, BSONObj* result)
+{
+	return boost::bind(find_one,_1,ns,query.getOwned(),result);
+}
@@ -0,0 +1,75 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ASYNC_QUERY_H
+#define _ASYNC_QUERY_H
+
+#include "work_queue.h"
+#include "conn_pool.h"
+#include <string>
+
+#include <mongo/client/dbclient.h>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/*
+ * 异步查询线程池（在gridfs_init中创建，未创建时查询在提交者线程中立即执行）
+ */
+extern WorkQueue* io_queue;
+
+/*
+ * 在io_queue上执行的一次mongodb操作：互不依赖的查询各自提交后再依次等待，
+ * 各占一个连接并发执行，总耗时约为其中最慢的一次往返。
+ * 析构时等待操作完成，操作写入的结果在wait()返回后可用
+ */
+class AsyncQuery {
+public:
+    typedef boost::function<void(mongo::DBClientBase&)> Op;
+
+    // 提交操作，从pool借出连接执行
+    AsyncQuery(ConnPool& pool, const Op& op);
+    ~AsyncQuery();
+
+    // 等待操作完成，操作抛出的DBException在此以UserException重新抛出
+    void wait();
+
+private:
+    struct State {
+        State() : done(false) {}
+        boost::mutex mutex;
+        boost::condition_variable done_cond;
+        bool done;
+        std::string error;
+    };
+
+    static void run(ConnPool* pool, Op op, boost::shared_ptr<State> state);
+
+    AsyncQuery(const AsyncQuery&);
+    AsyncQuery& operator=(const AsyncQuery&);
+
+    boost::shared_ptr<State> _state;
+};
+
+/*
+ * findOne操作，结果写入*result
+ */
+AsyncQuery::Op find_one_op(const std::string& ns, const mongo::BSONObj& query,
+                           mongo::BSONObj* result);
+
+#endif
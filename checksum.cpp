@@ -0,0 +1,135 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "checksum.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+static string to_hex(const unsigned char* bytes, int len)
+{
+    string hex;
+    char buf[3];
+    for(int i = 0; i < len; i++) {
+        snprintf(buf, sizeof(buf), "%02x", bytes[i]);
+        hex += buf;
+    }
+    return hex;
+}
+
+StreamChecksum::StreamChecksum(Type type) :
+_type(type), _next(0), _valid(true)
+{
+    md5_init(&_md5);
+#ifdef HAVE_XXHASH
+    _xxh3 = NULL;
+    if(_type == XXH3) {
+        _xxh3 = XXH3_createState();
+        XXH3_64bits_reset(_xxh3);
+    }
+#endif
+}
+
+StreamChecksum::~StreamChecksum()
+{
+#ifdef HAVE_XXHASH
+    if(_xxh3) {
+        XXH3_freeState(_xxh3);
+    }
+#endif
+}
+
+bool StreamChecksum::parseType(const char* name, Type& type)
+{
+    if(strcmp(name, "none") == 0) {
+        type = NONE;
+    } else if(strcmp(name, "md5") == 0) {
+        type = MD5;
+#ifdef HAVE_XXHASH
+    } else if(strcmp(name, "xxh3") == 0) {
+        type = XXH3;
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void StreamChecksum::update(off_t offset, const char* data, size_t len)
+{
+    if(!_valid || _type == NONE) {
+        return;
+    }
+    if(offset != _next) {
+        _valid = false;
+        return;
+    }
+
+    if(_type == MD5) {
+        md5_append(&_md5, (const md5_byte_t*)data, len);
+    }
+#ifdef HAVE_XXHASH
+    if(_type == XXH3) {
+        XXH3_64bits_update(_xxh3, data, len);
+    }
+#endif
+    _next += len;
+}
+
+void StreamChecksum::truncate(off_t length)
+{
+    if(length != _next) {
+        _valid = false;
+    }
+}
+
+const char* StreamChecksum::field() const
+{
+    switch(_type) {
+    case MD5:
+        return "md5";
+    case XXH3:
+        return "xxh3";
+    default:
+        return NULL;
+    }
+}
+
+string StreamChecksum::digest(off_t length) const
+{
+    if(!_valid || _type == NONE || _next != length) {
+        return "";
+    }
+
+    if(_type == MD5) {
+        // finishing consumes the state, later appends continue from _md5
+        md5_state_t state = _md5;
+        md5_byte_t sum[16];
+        md5_finish(&state, sum);
+        return to_hex(sum, sizeof(sum));
+    }
+#ifdef HAVE_XXHASH
+    if(_type == XXH3) {
+        XXH64_canonical_t sum;
+        XXH64_canonicalFromHash(&sum, XXH3_64bits_digest(_xxh3));
+        return to_hex(sum.digest, sizeof(sum.digest));
+    }
+#endif
+    return "";
+}
@@ -0,0 +1,66 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <string>
+#include <sys/types.h>
+
+#include <mongo/util/md5.h>
+
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+// Checksum of a file computed while it is written, so the fs.files
+// document can carry it without the server re-reading every chunk.
+// Only meaningful if the file was written front to back in one pass.
+class StreamChecksum {
+public:
+    enum Type { NONE, MD5, XXH3 };
+
+    StreamChecksum(Type type);
+    ~StreamChecksum();
+
+    // parses the --checksum option, returns false for unknown names
+    static bool parseType(const char* name, Type& type);
+
+    // feeds a write; anything but an append at the current end makes
+    // the checksum unusable
+    void update(off_t offset, const char* data, size_t len);
+    // the file was cut or extended to length; only a no-op keeps the
+    // checksum usable
+    void truncate(off_t length);
+
+    // fs.files field the checksum is stored in, NULL for none
+    const char* field() const;
+    // hex digest of everything so far, empty unless it covers exactly
+    // the first length bytes of the file
+    std::string digest(off_t length) const;
+
+private:
+    Type _type;
+    off_t _next;
+    bool _valid;
+    md5_state_t _md5;
+#ifdef HAVE_XXHASH
+    XXH3_state_t* _xxh3;
+#endif
+};
+
+#endif
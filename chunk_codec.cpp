@@ -0,0 +1,112 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_codec.h"
+
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+// zstd level: fast enough for the flush path, close to the default ratio
+#define ZSTD_LEVEL 1
+
+bool ChunkCodec::parseType(const char* name, Type& type)
+{
+    if(strcmp(name, "none") == 0) {
+        type = NONE;
+#ifdef HAVE_LZ4
+    } else if(strcmp(name, "lz4") == 0) {
+        type = LZ4;
+#endif
+#ifdef HAVE_ZSTD
+    } else if(strcmp(name, "zstd") == 0) {
+        type = ZSTD;
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ChunkCodec::name(Type type)
+{
+    switch(type) {
+    case LZ4:
+        return "lz4";
+    case ZSTD:
+        return "zstd";
+    default:
+        return NULL;
+    }
+}
+
+bool ChunkCodec::compress(Type type, const char* src, int len,
+                          vector<char>& out)
+{
+    int clen = 0;
+
+    switch(type) {
+#ifdef HAVE_LZ4
+    case LZ4:
+        out.resize(LZ4_compressBound(len));
+        clen = LZ4_compress_default(src, &out[0], len, out.size());
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case ZSTD: {
+        out.resize(ZSTD_compressBound(len));
+        size_t res = ZSTD_compress(&out[0], out.size(), src, len, ZSTD_LEVEL);
+        clen = ZSTD_isError(res) ? 0 : (int)res;
+        break;
+    }
+#endif
+    default:
+        return false;
+    }
+
+    // incompressible data is cheaper to store raw
+    if(clen <= 0 || clen >= len) {
+        return false;
+    }
+    out.resize(clen);
+    return true;
+}
+
+int ChunkCodec::decompress(const char* codec, const char* src, int len,
+                           char* dst, int size)
+{
+#ifdef HAVE_LZ4
+    if(strcmp(codec, "lz4") == 0) {
+        int res = LZ4_decompress_safe(src, dst, len, size);
+        return res < 0 ? -1 : res;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if(strcmp(codec, "zstd") == 0) {
+        size_t res = ZSTD_decompress(dst, size, src, len);
+        return ZSTD_isError(res) ? -1 : (int)res;
+    }
+#endif
+    return -1;
+}
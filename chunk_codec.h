@@ -0,0 +1,48 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHUNK_CODEC_H
+#define _CHUNK_CODEC_H
+
+#include <vector>
+
+// Per-chunk compression. Compressed chunks carry the codec name in
+// their "codec" field; chunks without one are stored raw, so a mount
+// can read data written with any codec it was built with.
+class ChunkCodec {
+public:
+    enum Type { NONE, LZ4, ZSTD };
+
+    // parses the --compress option, returns false for unknown or
+    // unavailable codecs
+    static bool parseType(const char* name, Type& type);
+
+    // tag stored in the "codec" field, NULL for NONE
+    static const char* name(Type type);
+
+    // compresses len bytes of src into out, returns false (and leaves
+    // the chunk to be stored raw) if that does not make it smaller
+    static bool compress(Type type, const char* src, int len,
+                         std::vector<char>& out);
+
+    // decompresses a chunk tagged codec into dst, returns the
+    // decompressed size or -1 if the codec is unknown or the data bad
+    static int decompress(const char* codec, const char* src, int len,
+                          char* dst, int size);
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_pool.h"
+
+#include <map>
+#include <new>
+#include <cstdlib>
+
+#include <unistd.h>
+
+using namespace std;
+
+static boost::mutex pools_mutex;
+static map<int, ChunkPool*> pools;
+// each thread's view of pools, so lookups after the first take no lock
+static boost::thread_specific_ptr<map<int, ChunkPool*> > local_pools;
+
+static boost::mutex free_bytes_mutex;
+static long long free_bytes = 0;
+
+ChunkPool& ChunkPool::get(int chunkSize)
+{
+    map<int, ChunkPool*> *local = local_pools.get();
+    if(!local) {
+        local = new map<int, ChunkPool*>;
+        local_pools.reset(local);
+    }
+
+    ChunkPool*& found = (*local)[chunkSize];
+    if(!found) {
+        boost::mutex::scoped_lock lock(pools_mutex);
+
+        ChunkPool*& pool = pools[chunkSize];
+        if(!pool) {
+            // pools live as long as the process, thread caches point at them
+            pool = new ChunkPool(chunkSize);
+        }
+        found = pool;
+    }
+
+    return *found;
+}
+
+char* ChunkPool::alloc()
+{
+    ThreadCache *tc = cache();
+    if(!tc->bufs.empty()) {
+        char *buf = tc->bufs.back();
+        tc->bufs.pop_back();
+        return buf;
+    }
+
+    char *shared = NULL;
+    {
+    boost::mutex::scoped_lock lock(_mutex);
+    if(!_free.empty()) {
+        shared = _free.back();
+        _free.pop_back();
+    }
+    }
+    if(shared) {
+        boost::mutex::scoped_lock lock(free_bytes_mutex);
+        free_bytes -= _chunkSize;
+        return shared;
+    }
+
+    void *buf = NULL;
+    if(posix_memalign(&buf, sysconf(_SC_PAGESIZE), _chunkSize) != 0) {
+        throw bad_alloc();
+    }
+
+    return (char*)buf;
+}
+
+void ChunkPool::release(char* buf)
+{
+    ThreadCache *tc = cache();
+    if((int)tc->bufs.size() < POOL_THREAD_CACHE) {
+        tc->bufs.push_back(buf);
+        return;
+    }
+
+    releaseShared(buf);
+}
+
+ChunkPool::ThreadCache* ChunkPool::cache()
+{
+    ThreadCache *tc = _cache.get();
+    if(!tc) {
+        tc = new ThreadCache;
+        tc->pool = this;
+        _cache.reset(tc);
+    }
+
+    return tc;
+}
+
+void ChunkPool::releaseShared(char* buf)
+{
+    {
+    boost::mutex::scoped_lock lock(free_bytes_mutex);
+    if(free_bytes + _chunkSize > POOL_MAX_FREE_BYTES) {
+        lock.unlock();
+        free(buf);
+        return;
+    }
+    free_bytes += _chunkSize;
+    }
+
+    boost::mutex::scoped_lock lock(_mutex);
+    _free.push_back(buf);
+}
+
+// a finishing thread hands its cached buffers back to the pool
+ChunkPool::ThreadCache::~ThreadCache()
+{
+    for(vector<char*>::iterator i = bufs.begin(); i != bufs.end(); i++) {
+        pool->releaseShared(*i);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHUNK_POOL_H
+#define _CHUNK_POOL_H
+
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+// buffers each thread keeps for itself before returning them to the pool
+const int POOL_THREAD_CACHE = 4;
+// bytes of free buffers all pools together keep before handing memory
+// back to the system
+const long long POOL_MAX_FREE_BYTES = 32 * 1024 * 1024;
+
+// Recycles fixed-size, page-aligned chunk buffers. Buffers are not zeroed.
+class ChunkPool {
+public:
+    // the pool for buffers of chunkSize bytes, found without locking once
+    // the calling thread has used it
+    static ChunkPool& get(int chunkSize);
+
+    char* alloc();
+    void release(char* buf);
+
+private:
+    struct ThreadCache {
+        ChunkPool* pool;
+        std::vector<char*> bufs;
+        ~ThreadCache();
+    };
+
+    ChunkPool(int chunkSize) : _chunkSize(chunkSize) {}
+
+    ThreadCache* cache();
+    void releaseShared(char* buf);
+
+    int _chunkSize;
+    boost::mutex _mutex;
+    std::vector<char*> _free;
+    boost::thread_specific_ptr<ThreadCache> _cache;
+};
+
+#endif
@@ -0,0 +1,598 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_store.h"
+#include "chunk_codec.h"
+#include "options.h"
+#include "conn_pool.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+
+#include <mongo/client/connpool.h>
+#include <boost/bind.hpp>
+
+#ifdef HAVE_OPENSSL
+#include <openssl/sha.h>
+#endif
+
+using namespace std;
+using namespace mongo;
+
+WorkQueue* upload_queue = NULL;
+
+static WriteConcern chunk_wc;//块写入的写关注
+static WriteConcern meta_wc;//元数据写入的写关注
+static bool chunk_wc_set = false;
+static bool meta_wc_set = false;
+static ChunkCodec::Type chunk_codec = ChunkCodec::NONE;//块压缩算法
+
+/**
+ * 由挂载选项构造写关注，均未设置时返回false（使用驱动默认值）
+ * wc：构造的写关注
+ * w：写入确认的节点数或模式（如"majority"）
+ * j：是否等待写入日志
+ * wtimeout：等待确认的超时（毫秒）
+ **/
+static bool make_write_concern(WriteConcern& wc, const char* w, int j, int wtimeout)
+{
+	if(w == NULL && !j && wtimeout <= 0){
+		return false;
+	}
+
+	if(w != NULL){
+		char *end;
+		long nodes = strtol(w,&end,10);
+		if(*w != '\0' && *end == '\0'){
+			wc.nodes(nodes);
+		}else{
+			wc.mode(w);
+		}
+	}
+	if(j){
+		wc.journal(true);
+	}
+	if(wtimeout > 0){
+		wc.timeout(wtimeout);
+	}
+	return true;
+}
+
+/**
+ * 构造块及元数据的写关注（在gridfs_init中调用）
+ **/
+void init_write_concerns()
+{
+	chunk_wc_set = make_write_concern(chunk_wc,gridfs_options.chunk_w,
+									  gridfs_options.chunk_j,gridfs_options.chunk_wtimeout);
+	meta_wc_set = make_write_concern(meta_wc,gridfs_options.meta_w,
+									 gridfs_options.meta_j,gridfs_options.meta_wtimeout);
+}
+
+/**
+ * 由--compress选项确定块压缩算法（在gridfs_init中调用）
+ **/
+void init_chunk_codec()
+{
+	if(gridfs_options.compress == NULL ||
+	   !ChunkCodec::parseType(gridfs_options.compress,chunk_codec)){
+		chunk_codec = ChunkCodec::NONE;
+	}
+}
+
+const WriteConcern* chunk_write_concern()
+{
+	return chunk_wc_set ? &chunk_wc : NULL;
+}
+
+const WriteConcern* meta_write_concern()
+{
+	return meta_wc_set ? &meta_wc : NULL;
+}
+
+/**
+ * 构造块文档，启用压缩且能压小时data为压缩后的数据，并以codec字段标明算法
+ * files_id：文件id
+ * n：块号
+ * data：块数据
+ * len：块数据大小
+ **/
+BSONObj chunk_doc(const OID& files_id, int n, const char* data, int len)
+{
+	BSONObjBuilder b;
+	b.append("files_id",files_id);
+	b.append("n",n);
+
+	vector<char> packed;
+	if(ChunkCodec::compress(chunk_codec,data,len,packed)){
+		b.appendBinData("data",packed.size(),BinDataGeneral,&packed[0]);
+		b.append("codec",ChunkCodec::name(chunk_codec));
+	}else{
+		b.appendBinData("data",len,BinDataGeneral,data);//不可压缩的块原样保存
+	}
+	return b.obj();
+}
+
+/**
+ * 计算块内容的散列（SHA-256的十六进制串），作为去重块的_id
+ * data：块数据
+ * len：块数据大小
+ **/
+static string content_hash(const char* data, int len)
+{
+#ifdef HAVE_OPENSSL
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256((const unsigned char*)data,len,digest);
+
+	static const char hex[] = "0123456789abcdef";
+	string hash;
+	for(int i = 0; i < SHA256_DIGEST_LENGTH; i++){
+		hash += hex[digest[i] >> 4];
+		hash += hex[digest[i] & 0xf];
+	}
+	return hash;
+#else
+	return string();
+#endif
+}
+
+/**
+ * 对集合执行findAndModify，返回修改前（new_doc为true时为修改后）的文档，不存在时为空
+ * coll：集合名（如"fs.blobs"）
+ * query：查询条件
+ * update：更新内容
+ * upsert：不存在时是否插入
+ * new_doc：是否返回修改后的文档
+ **/
+static BSONObj find_and_modify(DBClientBase& conn, const char* coll, const BSONObj& query,
+                               const BSONObj& update, bool upsert, bool new_doc)
+{
+	BSONObj res;
+	conn.runCommand(gridfs_options.db,
+					BSON("findAndModify" << coll << "query" << query << "update" << update <<
+						 "upsert" << upsert << "new" << new_doc),res);
+	return res.getObjectField("value");
+}
+
+/**
+ * 增加去重块的引用计数，块不存在时才上传数据
+ * hash：块内容散列
+ * chunk：块文档（data及codec字段存入去重块）
+ **/
+static void ref_blob(DBClientBase& conn, const string& hash, const BSONObj& chunk)
+{
+	//已存在的块只增加引用，不再上传数据
+	if(!find_and_modify(conn,"fs.blobs",BSON("_id" << hash),
+						BSON("$inc" << BSON("refs" << 1)),false,false).isEmpty()){
+		return;
+	}
+
+	//并发写入同一内容时由$setOnInsert保证数据只写入一次
+	BSONObjBuilder data_obj;
+	data_obj.append(chunk["data"]);
+	if(chunk.hasField("codec")){
+		data_obj.append(chunk["codec"]);
+	}
+	conn.update(string(gridfs_options.db)+string(".fs.blobs"),BSON("_id" << hash),
+				BSON("$inc" << BSON("refs" << 1) << "$setOnInsert" << data_obj.obj()),
+				true,false,chunk_write_concern());
+}
+
+/**
+ * 减少去重块的引用计数，计数为0时删除该块
+ * hash：块内容散列
+ **/
+static void unref_blob(DBClientBase& conn, const string& hash)
+{
+	BSONObj blob = find_and_modify(conn,"fs.blobs",BSON("_id" << hash),
+								   BSON("$inc" << BSON("refs" << -1)),false,true);
+	if(!blob.isEmpty() && blob.getIntField("refs") <= 0){
+		conn.remove(string(gridfs_options.db)+string(".fs.blobs"),
+					BSON("_id" << hash << "refs" << BSON("$lte" << 0)),false,chunk_write_concern());
+	}
+}
+
+/**
+ * 释放满足条件的文件块所引用的去重块（在删除这些文件块之前调用）
+ * query：文件块查询条件
+ **/
+static void unref_chunks(DBClientBase& conn, const BSONObj& query)
+{
+	string chunks_ns = string(gridfs_options.db)+string(".fs.chunks");//块命名空间
+
+	BSONObjBuilder q;
+	q.appendElements(query);
+	q.append("hash",BSON("$exists" << true));
+
+	BSONObj fields = BSON("hash" << 1);
+	auto_ptr<DBClientCursor> cursor = conn.query(chunks_ns,q.obj(),0,0,&fields);
+	vector<string> hashes;
+	while(cursor->more()){
+		hashes.push_back(cursor->next().getStringField("hash"));
+	}
+	for(vector<string>::iterator h = hashes.begin(); h != hashes.end(); h++){
+		unref_blob(conn,*h);
+	}
+}
+
+/**
+ * 去重模式下写入（覆盖）一个文件块：数据按内容散列存入fs.blobs，
+ * fs.chunks中只保存引用{files_id, n, hash}，被覆盖的旧块引用随之释放
+ * 散列按存储的（可能已压缩的）数据计算
+ * chunk：块文档
+ **/
+static void store_dedup_chunk(DBClientBase& conn, const BSONObj& chunk)
+{
+	OID files_id = chunk["files_id"].OID();
+	int n = chunk.getIntField("n");
+
+	int len = 0;
+	const char *data = chunk["data"].binData(len);
+	string hash = content_hash(data,len);
+	ref_blob(conn,hash,chunk);
+
+	BSONObj old = find_and_modify(conn,"fs.chunks",BSON("files_id" << files_id << "n" << n),
+								  BSON("files_id" << files_id << "n" << n << "hash" << hash),
+								  true,false);
+	if(old.hasField("hash")){
+		unref_blob(conn,old.getStringField("hash"));
+	}
+}
+
+/**
+ * 写入（覆盖）一个文件块
+ * chunk：块文档
+ **/
+void store_chunk(DBClientBase& conn, const BSONObj& chunk)
+{
+	string chunks_ns = string(gridfs_options.db)+string(".fs.chunks");//块命名空间
+
+	if(gridfs_options.dedup){
+		store_dedup_chunk(conn,chunk);
+		return;
+	}
+
+	//以{files_id, n}为键更新，不存在则插入
+	conn.update(chunks_ns,
+				BSON("files_id" << chunk["files_id"] << "n" << chunk["n"]),chunk,true,false,
+				chunk_write_concern());
+}
+
+void store_chunk(DBClientBase& conn, const OID& files_id,
+                 int n, const char* data, int len)
+{
+	store_chunk(conn,chunk_doc(files_id,n,data,len));
+}
+
+/**
+ * 将已打开文件中的脏块写入数据库，未修改的块及空洞不写入
+ * files_id：文件id
+ * lgf：已打开文件
+ **/
+int store_dirty_chunks(DBClientBase& conn, const OID& files_id,
+                       LocalGridFile* lgf)
+{
+	vector<int> dirty;
+	lgf->getDirtyChunks(dirty);
+
+	//不分批或去重模式下逐块更新
+	int batch_size = gridfs_options.flush_batch;
+	if(batch_size <= 1 || gridfs_options.dedup){
+		for(vector<int>::iterator n = dirty.begin(); n != dirty.end(); n++){
+			store_chunk(conn,files_id,*n,lgf->getChunk(*n),lgf->getChunkLength(*n));
+		}
+		return dirty.size();
+	}
+
+	string chunks_ns = string(gridfs_options.db)+string(".fs.chunks");//块命名空间
+
+	/*
+	 * 每批以{files_id, n}为键覆盖写入，不先删除原有块，写入失败时原有块仍在；
+	 * bulk_chunks时为无序批量写，批内各块互不等待，否则按顺序写入，出错即停止
+	 */
+	for(size_t first = 0; first < dirty.size(); first += batch_size){
+		size_t last = min(dirty.size(), first + batch_size);
+
+		BulkOperationBuilder bulk = gridfs_options.bulk_chunks ?
+			conn.initializeUnorderedBulkOp(chunks_ns) : conn.initializeOrderedBulkOp(chunks_ns);
+		for(size_t i = first; i < last; i++){
+			int n = dirty[i];
+			bulk.find(BSON("files_id" << files_id << "n" << n)).upsert().
+				replaceOne(chunk_doc(files_id,n,lgf->getChunk(n),lgf->getChunkLength(n)));
+		}
+
+		WriteResult result;
+		bulk.execute(chunk_write_concern(),&result);
+	}
+
+	return dirty.size();
+}
+
+/**
+ * 读取一个文件块（块不存在即为空洞，返回0；去重块引用的数据不存在时抛出异常）
+ * files_id：文件id
+ * n：块号
+ * buf：缓存读出的数据
+ * size：buf大小
+ **/
+int fetch_chunk(DBClientBase& conn, const OID& files_id, int n,
+                char* buf, int size)
+{
+	string chunks_ns = string(gridfs_options.db)+string(".fs.chunks");//块命名空间
+
+	BSONObj chunk = conn.findOne(chunks_ns,BSON("files_id" << files_id << "n" << n));
+	if(chunk.isEmpty()){
+		return 0;
+	}
+
+	//去重块只保存引用，数据在fs.blobs中
+	if(!chunk.hasField("data") && chunk.hasField("hash")){
+		string hash = chunk.getStringField("hash");
+		chunk = conn.findOne(string(gridfs_options.db)+string(".fs.blobs"),BSON("_id" << hash));
+		if(chunk.isEmpty()){
+			//引用的数据丢失，不能当作空洞读出零
+			uasserted(17504,string("missing blob ")+hash+" of a deduplicated chunk");
+		}
+	}
+
+	int len = 0;
+	const char *data = chunk["data"].binData(len);
+
+	//压缩的块按codec字段解压
+	if(chunk.hasField("codec")){
+		len = ChunkCodec::decompress(chunk.getStringField("codec"),data,len,buf,size);
+		if(len < 0){
+			uasserted(17501,string("cannot decompress chunk with codec ")+chunk.getStringField("codec"));
+		}
+		return len;
+	}
+
+	len = min(len,size);
+	memcpy(buf,data,len);
+	return len;
+}
+
+/**
+ * 删除文件文档及其全部块
+ * files_id：文件id
+ **/
+void remove_file(DBClientBase& conn, const OID& files_id)
+{
+	string db_name = gridfs_options.db;//获取数据库名
+
+	unref_chunks(conn,BSON("files_id" << files_id));
+	conn.remove(db_name + ".fs.chunks",BSON("files_id" << files_id),false,chunk_write_concern());
+	conn.remove(db_name + ".fs.files",BSON("_id" << files_id),false,meta_write_concern());
+}
+
+/**
+ * 克隆文件：又一个节点引用该文件，clones加1（未设置时为0）
+ * files_id：文件id
+ **/
+void clone_file(DBClientBase& conn, const OID& files_id)
+{
+	conn.update(string(gridfs_options.db)+string(".fs.files"),BSON("_id" << files_id),
+				BSON("$inc" << BSON("clones" << 1)),false,false,meta_write_concern());
+}
+
+/**
+ * 释放节点对文件的引用：仍有其他节点共用时只减少计数，否则删除文件
+ * files_id：文件id
+ **/
+void release_file(DBClientBase& conn, const OID& files_id)
+{
+	if(find_and_modify(conn,"fs.files",BSON("_id" << files_id << "clones" << BSON("$gt" << 0)),
+					   BSON("$inc" << BSON("clones" << -1)),false,false).isEmpty()){
+		remove_file(conn,files_id);
+	}
+}
+
+/**
+ * 在服务器端复制文件的全部块：聚合管道以$merge把改写了files_id的块写回fs.chunks
+ * （需要MongoDB 4.4及以上），客户端只收发命令，去重块只增加引用计数
+ * src_id：源文件id
+ * dst_id：目标文件id
+ **/
+void copy_chunks(DBClientBase& conn, const OID& src_id, const OID& dst_id)
+{
+	string chunks_ns = string(gridfs_options.db)+string(".fs.chunks");//块命名空间
+
+	trim_chunks(conn,dst_id,0);//删除目标文件原有的块
+
+	BSONObj pipeline = BSON_ARRAY(
+		BSON("$match" << BSON("files_id" << src_id)) <<
+		BSON("$project" << BSON("_id" << 0 << "files_id" << BSON("$literal" << dst_id) <<
+								"n" << 1 << "data" << 1 << "codec" << 1 << "hash" << 1)) <<
+		BSON("$merge" << BSON("into" << "fs.chunks" << "on" << BSON_ARRAY("files_id" << "n") <<
+							  "whenMatched" << "replace" << "whenNotMatched" << "insert")));
+	BSONObj res;
+	if(!conn.runCommand(gridfs_options.db,
+						BSON("aggregate" << "fs.chunks" << "pipeline" << pipeline <<
+							 "cursor" << BSONObj()),res)){
+		uasserted(17502,string("server-side chunk copy failed: ")+res.getStringField("errmsg"));
+	}
+
+	//复制的去重块引用计数加1（按散列合并）
+	map<string, int> refs;
+	BSONObj fields = BSON("hash" << 1);
+	auto_ptr<DBClientCursor> cursor = conn.query(chunks_ns,
+			BSON("files_id" << dst_id << "hash" << BSON("$exists" << true)),0,0,&fields);
+	while(cursor->more()){
+		refs[cursor->next().getStringField("hash")]++;
+	}
+	for(map<string, int>::iterator r = refs.begin(); r != refs.end(); r++){
+		conn.update(string(gridfs_options.db)+string(".fs.blobs"),BSON("_id" << r->first),
+					BSON("$inc" << BSON("refs" << r->second)),false,false,chunk_write_concern());
+	}
+}
+
+/**
+ * 删除文件末尾多余的块（文件变短时）
+ * files_id：文件id
+ * num_chunks：文件现有块数
+ **/
+void trim_chunks(DBClientBase& conn, const OID& files_id, int num_chunks)
+{
+	string chunks_ns = string(gridfs_options.db)+string(".fs.chunks");//块命名空间
+
+	BSONObj query = BSON("files_id" << files_id << "n" << BSON("$gte" << num_chunks));
+	unref_chunks(conn,query);
+	conn.remove(chunks_ns,query,false,chunk_write_concern());
+}
+
+/**
+ * 更新fs.files中的文件文档（长度、块大小、校验和等），不存在时创建
+ * files_id：文件id
+ * name：文件名
+ * chunk_size：块大小
+ * length：文件长度
+ * sum_field：校验和字段名（"md5"、"xxh3"）
+ * sum：校验和
+ **/
+BSONObj store_file_doc(DBClientBase& conn, const OID& files_id,
+                       const string& name, int chunk_size, long long length,
+                       const char* sum_field, const string& sum)
+{
+	string db_name = gridfs_options.db;//获取数据库名
+	string files_ns = db_name + ".fs.files";//文件命名空间
+
+	BSONObjBuilder b;
+	b.append("filename",name);
+	b.append("chunkSize",chunk_size);
+	b.appendDate("uploadDate",jsTime());
+	b.appendNumber("length",length);
+
+	//校验和在写入过程中计算，不再由服务器端filemd5重新读取全部块
+	BSONObjBuilder unset;
+	const char *sum_fields[] = {"md5", "xxh3"};
+	for(size_t i = 0; i < sizeof(sum_fields) / sizeof(sum_fields[0]); i++){
+		if(sum_field != NULL && !sum.empty() && strcmp(sum_field,sum_fields[i]) == 0){
+			b.append(sum_field,sum);
+		}else{
+			unset.append(sum_fields[i],1);//删除与内容不符的旧校验和
+		}
+	}
+	BSONObj fields = b.obj();
+
+	//只设置上述字段而不整体替换，clones等由其他操作以$inc维护的字段保持不变
+	conn.update(files_ns,BSON("_id" << files_id),
+				BSON("$set" << fields << "$unset" << unset.obj()),true,false,meta_write_concern());
+
+	BSONObjBuilder file_obj;
+	file_obj.append("_id",files_id);
+	file_obj.appendElements(fields);
+	return file_obj.obj();
+}
+
+GridChunkBackend::GridChunkBackend(const OID& files_id, int window)
+	: _files_id(files_id), _key(files_id.toString()), _window(window),
+	  _failed(false)
+{
+}
+
+GridChunkBackend::~GridChunkBackend()
+{
+	//等待仍在上传的块，任务中引用了this
+	if(upload_queue){
+		upload_queue->wait(_key);
+	}
+}
+
+/**
+ * 提交一个块的上传任务（数据在返回前已复制到块文档中）
+ * n：块号
+ * data：块数据
+ * len：块数据大小
+ **/
+void GridChunkBackend::upload(int n, const char* data, int len)
+{
+	BSONObj chunk = chunk_doc(_files_id,n,data,len);
+	if(!upload_queue){
+		store(chunk);
+		return;
+	}
+	upload_queue->post(_key,boost::bind(&GridChunkBackend::store,this,chunk),_window);
+}
+
+/**
+ * 读取已存储的块数据，返回读出的字节数，失败时返回-EIO
+ * n：块号
+ * buf：缓存读出的数据
+ * size：buf大小
+ **/
+int GridChunkBackend::fetch(int n, char* buf, int size)
+{
+	try{
+		PooledConnection sdc(data_pool);
+		int len = fetch_chunk(sdc.conn(),_files_id,n,buf,size);
+		sdc.done();
+		return len;
+	}catch(DBException &e){
+		cout<<"[FETCH]: Error = "<<e.what()<<endl;
+	}
+	return -EIO;
+}
+
+/**
+ * 等待已提交的块全部写入，有块写入失败后（该块已丢失）始终返回-EIO
+ **/
+int GridChunkBackend::sync()
+{
+	if(upload_queue){
+		upload_queue->wait(_key);
+	}
+
+	boost::mutex::scoped_lock lock(_mutex);
+	return _failed ? -EIO : 0;
+}
+
+/**
+ * 删除块号不小于num_chunks的已存储块（文件被截短时），先等待已提交的块写完
+ * num_chunks：截短后的块数
+ **/
+int GridChunkBackend::truncate(int num_chunks)
+{
+	int res = sync();
+	try{
+		PooledConnection sdc(data_pool);
+		trim_chunks(sdc.conn(),_files_id,num_chunks);
+		sdc.done();
+	}catch(DBException &e){
+		cout<<"[TRUNCATE]: Error = "<<e.what()<<endl;
+		return -EIO;
+	}
+	return res;
+}
+
+/**
+ * 上传线程中执行：写入一个块
+ * chunk：块文档
+ **/
+void GridChunkBackend::store(BSONObj chunk)
+{
+	try{
+		PooledConnection sdc(data_pool);
+		store_chunk(sdc.conn(),chunk);
+		sdc.done();
+	}catch(DBException &e){
+		cout<<"[UPLOAD]: Error = "<<e.what()<<endl;
+		boost::mutex::scoped_lock lock(_mutex);
+		_failed = true;
+	}
+}
@@ -0,0 +1,142 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHUNK_STORE_H
+#define _CHUNK_STORE_H
+
+#include "local_gridfile.h"
+#include "work_queue.h"
+#include <string>
+#include <vector>
+
+#include <mongo/client/dbclient.h>
+#include <boost/thread/mutex.hpp>
+
+/*
+ * 块上传线程池（在gridfs_init中创建，未创建时不进行流式上传）
+ */
+extern WorkQueue* upload_queue;
+
+/*
+ * 由挂载选项构造写关注（在gridfs_init中调用）
+ */
+void init_write_concerns();
+
+/*
+ * 由--compress选项确定块压缩算法（在gridfs_init中调用）
+ */
+void init_chunk_codec();
+
+/*
+ * 块（fs.chunks）及元数据（fs.files、fs.nodes）写入使用的写关注，NULL为驱动默认
+ */
+const mongo::WriteConcern* chunk_write_concern();
+const mongo::WriteConcern* meta_write_concern();
+
+/*
+ * 构造块文档{files_id, n, data}，压缩的块另有codec字段
+ */
+mongo::BSONObj chunk_doc(const mongo::OID& files_id, int n,
+                         const char* data, int len);
+
+/*
+ * 写入（覆盖）文件块{files_id, n}
+ * 去重模式（--dedup）下数据按内容散列存入引用计数的fs.blobs，块文档只保存hash
+ */
+void store_chunk(mongo::DBClientBase& conn, const mongo::BSONObj& chunk);
+
+void store_chunk(mongo::DBClientBase& conn, const mongo::OID& files_id,
+                 int n, const char* data, int len);
+
+/*
+ * 将已打开文件中的脏块按flush_batch批量写入fs.chunks（空洞不写入），返回写入的块数
+ */
+int store_dirty_chunks(mongo::DBClientBase& conn, const mongo::OID& files_id,
+                       LocalGridFile* lgf);
+
+/*
+ * 读取文件块{files_id, n}（透明解压），返回读出的字节数（空洞为0）
+ */
+int fetch_chunk(mongo::DBClientBase& conn, const mongo::OID& files_id, int n,
+                char* buf, int size);
+
+/*
+ * 删除文件文档及其全部块（释放其引用的去重块）
+ */
+void remove_file(mongo::DBClientBase& conn, const mongo::OID& files_id);
+
+/*
+ * 克隆文件：文件文档的clones（与之共用的其他节点数）加1
+ */
+void clone_file(mongo::DBClientBase& conn, const mongo::OID& files_id);
+
+/*
+ * 释放节点对文件的引用：被克隆的文件只将clones减1，否则删除文件及其块
+ */
+void release_file(mongo::DBClientBase& conn, const mongo::OID& files_id);
+
+/*
+ * 在服务器端把文件src_id的全部块复制为文件dst_id的块（数据不经过客户端），
+ * dst_id原有的块先被删除；去重块只复制引用并增加引用计数
+ */
+void copy_chunks(mongo::DBClientBase& conn, const mongo::OID& src_id,
+                 const mongo::OID& dst_id);
+
+/*
+ * 删除块号不小于num_chunks的文件块
+ */
+void trim_chunks(mongo::DBClientBase& conn, const mongo::OID& files_id,
+                 int num_chunks);
+
+/*
+ * 更新（或创建）fs.files中的文件文档，返回更新后的文档
+ * 校验和由客户端写入时计算，sum_field为NULL或sum为空时不写入
+ */
+mongo::BSONObj store_file_doc(mongo::DBClientBase& conn,
+                              const mongo::OID& files_id,
+                              const std::string& name,
+                              int chunk_size, long long length,
+                              const char* sum_field = NULL,
+                              const std::string& sum = "");
+
+/*
+ * LocalGridFile的GridFS后端：块经upload_queue异步写入fs.chunks，
+ * 同一文件的块按提交顺序写入，未完成的块数不超过window
+ */
+class GridChunkBackend : public ChunkBackend {
+public:
+    GridChunkBackend(const mongo::OID& files_id, int window);
+    ~GridChunkBackend();
+
+    const mongo::OID& getFilesId() const { return _files_id; }
+
+    void upload(int n, const char* data, int len);
+    int fetch(int n, char* buf, int size);
+    int sync();
+    int truncate(int num_chunks);
+
+private:
+    void store(mongo::BSONObj chunk);
+
+    mongo::OID _files_id;
+    std::string _key;
+    int _window;
+    boost::mutex _mutex;
+    bool _failed;
+};
+
+#endif
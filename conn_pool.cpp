@@ -0,0 +1,172 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "conn_pool.h"
+
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <sys/time.h>
+
+#include <mongo/client/connpool.h>
+
+using namespace std;
+using namespace mongo;
+
+ConnPool meta_pool;
+ConnPool data_pool;
+
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+ConnPool::ThreadConn::~ThreadConn()
+{
+    delete conn;
+}
+
+ConnPool::ConnPool()
+    : _size(0), _sticky(false), _in_use(0),
+      _acquired(0), _waited(0), _wait_us(0), _max_wait_us(0)
+{
+}
+
+void ConnPool::configure(const string& host, int size, bool sticky)
+{
+    _host = host;
+    _size = size;
+    _sticky = sticky;
+}
+
+void ConnPool::prewarm(int n)
+{
+    // 驱动的连接池保留的空闲连接数须容纳预先建立的连接
+    if(pool.getMaxPoolSize() < n) {
+        pool.setMaxPoolSize(n);
+    }
+
+    vector<DBClientBase*> conns;
+    try {
+        for(int i = 0; i < n; i++) {
+            conns.push_back(pool.get(_host));
+        }
+    } catch(DBException &e) {
+        cout << "[POOL]: Error = " << e.what() << endl;
+    }
+
+    for(size_t i = 0; i < conns.size(); i++) {
+        pool.release(_host, conns[i]);
+    }
+}
+
+ConnPool::ThreadConn& ConnPool::threadConn()
+{
+    ThreadConn *tc = _thread_conn.get();
+    if(!tc) {
+        tc = new ThreadConn;
+        _thread_conn.reset(tc);
+    }
+    return *tc;
+}
+
+DBClientBase* ConnPool::acquire()
+{
+    long long start = now_us();
+    ThreadConn &tc = threadConn();
+
+    // 只有线程借出的第一个连接占用名额
+    bool limited = _size > 0 && tc.depth == 0;
+    if(limited) {
+        boost::mutex::scoped_lock lock(_mutex);
+        while(_in_use >= _size) {
+            _free_cond.wait(lock);
+        }
+        _in_use++;
+    }
+    tc.depth++;
+
+    DBClientBase *conn = NULL;
+    if(_sticky && tc.conn) {
+        conn = tc.conn;
+        tc.conn = NULL;
+        if(conn->isFailed()) {
+            delete conn;
+            conn = NULL;
+        }
+    }
+
+    if(!conn) {
+        try {
+            conn = pool.get(_host);
+        } catch(...) {
+            tc.depth--;
+            if(limited) {
+                boost::mutex::scoped_lock lock(_mutex);
+                _in_use--;
+                _free_cond.notify_one();
+            }
+            throw;
+        }
+    }
+
+    // 等待时间包括等待名额及新建连接的时间
+    long long wait_us = now_us() - start;
+    boost::mutex::scoped_lock lock(_mutex);
+    _acquired++;
+    if(wait_us >= 1000) {
+        _waited++;
+    }
+    _wait_us += wait_us;
+    if(wait_us > _max_wait_us) {
+        _max_wait_us = wait_us;
+    }
+    return conn;
+}
+
+void ConnPool::release(DBClientBase* conn, bool ok)
+{
+    ThreadConn &tc = threadConn();
+
+    if(!ok || conn->isFailed()) {
+        delete conn;
+    } else if(_sticky && tc.conn == NULL) {
+        tc.conn = conn;
+    } else {
+        pool.release(_host, conn);
+    }
+
+    if(--tc.depth == 0 && _size > 0) {
+        boost::mutex::scoped_lock lock(_mutex);
+        _in_use--;
+        _free_cond.notify_one();
+    }
+}
+
+string ConnPool::stats()
+{
+    boost::mutex::scoped_lock lock(_mutex);
+
+    char buf[128];
+    snprintf(buf, sizeof(buf),
+             "acquired=%lld waited=%lld avg_wait_us=%lld max_wait_us=%lld",
+             _acquired, _waited, _acquired ? _wait_us / _acquired : 0,
+             _max_wait_us);
+    return buf;
+}
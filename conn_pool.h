@@ -0,0 +1,111 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CONN_POOL_H
+#define _CONN_POOL_H
+
+#include <string>
+
+#include <mongo/client/dbclient.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+/*
+ * mongodb连接池：在驱动的全局连接池之上限制同时借出的连接数，
+ * 可在挂载时预先建立连接，可为每个线程保留一个连接，并统计借出连接的等待时间
+ */
+class ConnPool {
+public:
+    ConnPool();
+
+    // size>0时同时借出的连接数不超过size；sticky时每个线程归还的连接留给该线程下次使用
+    void configure(const std::string& host, int size, bool sticky);
+
+    // 预先建立n个连接放入驱动的连接池
+    void prewarm(int n);
+
+    // 借出连接，达到上限时等待；同一线程嵌套借出时不受上限限制，避免互相等待
+    mongo::DBClientBase* acquire();
+
+    // 归还连接，ok为false（操作未完成）时关闭该连接
+    void release(mongo::DBClientBase* conn, bool ok);
+
+    // 等待时间统计，形如"acquired=.. waited=.. avg_wait_us=.. max_wait_us=.."，
+    // 等待时间包括新建连接的时间，waited为等待超过1毫秒的次数
+    std::string stats();
+
+private:
+    // 线程保留的连接
+    struct ThreadConn {
+        ThreadConn() : conn(NULL), depth(0) {}
+        ~ThreadConn();
+        mongo::DBClientBase* conn;
+        int depth;//该线程借出未还的连接数
+    };
+
+    ThreadConn& threadConn();
+
+    std::string _host;
+    int _size;
+    bool _sticky;
+    boost::thread_specific_ptr<ThreadConn> _thread_conn;
+
+    boost::mutex _mutex;
+    boost::condition_variable _free_cond;
+    int _in_use;
+
+    // 等待时间统计，由_mutex保护
+    long long _acquired;
+    long long _waited;
+    long long _wait_us;
+    long long _max_wait_us;
+};
+
+/*
+ * 从ConnPool借出的连接，用法同ScopedDbConnection：
+ * 操作完成后调用done()归还，未调用done()即析构时关闭该连接
+ */
+class PooledConnection {
+public:
+    explicit PooledConnection(ConnPool& pool)
+        : _pool(pool), _conn(pool.acquire()) {}
+
+    ~PooledConnection() {
+        if(_conn) {
+            _pool.release(_conn, false);
+        }
+    }
+
+    mongo::DBClientBase& conn() { return *_conn; }
+
+    void done() {
+        _pool.release(_conn, true);
+        _conn = NULL;
+    }
+
+private:
+    ConnPool& _pool;
+    mongo::DBClientBase* _conn;
+};
+
+// 元数据操作（getattr、readdir、access等）与块数据传输分用两个连接池，
+// 大文件读写占满数据连接池时元数据操作不必排队
+extern ConnPool meta_pool;
+extern ConnPool data_pool;
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "file_table.h"
+
+#include <algorithm>
+
+#include <boost/functional/hash.hpp>
+
+using namespace std;
+
+FileTable::Shard& FileTable::shard(const string& path)
+{
+    return _shards[boost::hash<string>()(path) % SHARDS];
+}
+
+OpenFile* FileTable::open(const string& path, LocalGridFile* lgf, mode_t mode)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    OpenFile *&file = s.files[path];
+    if(!file) {
+        file = new OpenFile;
+        file->path = path;
+        file->lgf = lgf;
+        file->mode = mode;
+        file->refs = 0;
+    }
+    file->refs++;
+    return file;
+}
+
+OpenFile* FileTable::acquire(const string& path)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    boost::unordered_map<string, OpenFile*>::iterator i = s.files.find(path);
+    if(i == s.files.end()) {
+        return NULL;
+    }
+
+    i->second->refs++;
+    return i->second;
+}
+
+bool FileTable::contains(const string& path)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    return s.files.count(path) > 0;
+}
+
+FileTable::Shard& FileTable::lockShard(OpenFile* file, boost::mutex::scoped_lock& lock)
+{
+    // 加锁前文件可能被重命名到其他分片，加锁后路径未变即不会再变
+    while(true) {
+        string p = path(file);
+        Shard &s = shard(p);
+        boost::mutex::scoped_lock l(s.mutex);
+        if(path(file) == p) {
+            lock.swap(l);
+            return s;
+        }
+    }
+}
+
+void FileTable::hold(OpenFile* file)
+{
+    boost::mutex::scoped_lock lock;
+    lockShard(file, lock);
+
+    file->refs++;
+}
+
+string FileTable::path(OpenFile* file)
+{
+    boost::mutex::scoped_lock lock(_path_mutex);
+    return file->path;
+}
+
+void FileTable::rename(const string& path, const string& new_path)
+{
+    // 按分片地址顺序加锁，避免与其他重命名死锁
+    Shard *first = &shard(path);
+    Shard *second = &shard(new_path);
+    if(second < first) {
+        swap(first, second);
+    }
+    boost::mutex::scoped_lock lock1(first->mutex);
+    boost::mutex::scoped_lock lock2;
+    if(second != first) {
+        boost::mutex::scoped_lock l(second->mutex);
+        lock2.swap(l);
+    }
+
+    Shard &from = shard(path);
+    boost::unordered_map<string, OpenFile*>::iterator i = from.files.find(path);
+    if(i == from.files.end()) {
+        return;
+    }
+
+    // 覆盖的已打开文件与路径脱离（路径置空），不再写回，其最后一次释放不会移除移入的文件
+    OpenFile *file = i->second;
+    from.files.erase(i);
+    OpenFile *&target = shard(new_path).files[new_path];
+    OpenFile *displaced = target;
+    target = file;
+
+    boost::mutex::scoped_lock path_lock(_path_mutex);
+    file->path = new_path;
+    if(displaced && displaced != file) {
+        displaced->path.clear();
+    }
+}
+
+bool FileTable::release(OpenFile* file)
+{
+    boost::mutex::scoped_lock lock;
+    Shard &s = lockShard(file, lock);
+
+    if(--file->refs > 0) {
+        return false;
+    }
+
+    boost::unordered_map<string, OpenFile*>::iterator i = s.files.find(file->path);
+    if(i != s.files.end() && i->second == file) {
+        s.files.erase(i);
+    }
+    return true;
+}
+
+void FileTable::beginLoad(const string& path)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    while(s.blocked.count(path)) {
+        s.unblocked.wait(lock);
+    }
+    s.loading[path]++;
+}
+
+void FileTable::endLoad(const string& path)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    if(--s.loading[path] == 0) {
+        s.loading.erase(path);
+    }
+}
+
+bool FileTable::block(const string& path)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    if(s.files.count(path) || s.loading.count(path)) {
+        return false;
+    }
+    s.blocked[path]++;
+    return true;
+}
+
+void FileTable::unblock(const string& path)
+{
+    Shard &s = shard(path);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    if(--s.blocked[path] == 0) {
+        s.blocked.erase(path);
+        s.unblocked.notify_all();
+    }
+}
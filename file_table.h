@@ -0,0 +1,106 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILE_TABLE_H
+#define _FILE_TABLE_H
+
+#include "local_gridfile.h"
+#include <string>
+#include <sys/types.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/unordered_map.hpp>
+
+/*
+ * 已打开文件：同一路径的多次打开共用一个本地缓存，每次打开（及临时使用者）持有一个引用，
+ * 其指针即为fuse_file_info中的文件句柄
+ */
+struct OpenFile {
+    std::string path;//由FileTable::path读取，被重命名覆盖后为空
+    LocalGridFile* lgf;
+    mode_t mode;
+    int refs;//由所在分片的锁保护
+};
+
+/*
+ * 已打开文件表：按路径散列分片，每片一把锁，不同文件的查找互不阻塞；
+ * 对文件内容的读写由各LocalGridFile自身的锁保护
+ */
+class FileTable {
+public:
+    // 打开path并持有一个引用；已打开时返回已有的OpenFile，lgf未被采用，由调用者删除
+    OpenFile* open(const std::string& path, LocalGridFile* lgf, mode_t mode);
+
+    // path已打开时持有一个引用并返回，否则返回NULL
+    OpenFile* acquire(const std::string& path);
+
+    // path是否已打开
+    bool contains(const std::string& path);
+
+    // 再持有一个引用，调用者须已持有引用
+    void hold(OpenFile* file);
+
+    // 已打开文件的当前路径（重命名后随之改变，被覆盖的文件为空串）
+    std::string path(OpenFile* file);
+
+    // 将path处已打开的文件移到new_path，供重命名使用；new_path处原已打开的文件与路径脱离
+    void rename(const std::string& path, const std::string& new_path);
+
+    // 释放一个引用；最后一个引用释放时移出表并返回true，OpenFile及其本地缓存由调用者删除
+    bool release(OpenFile* file);
+
+    // 标记path正在以其原有文件id载入以便修改（写打开、截断）；path被克隆占用时先等待
+    void beginLoad(const std::string& path);
+    void endLoad(const std::string& path);
+
+    // 克隆期间占用path：path已打开或正在载入时返回false，占用期间beginLoad等待
+    bool block(const std::string& path);
+    void unblock(const std::string& path);
+
+    // 作用域内标记path正在载入
+    class Loading {
+    public:
+        Loading(FileTable& table, const std::string& path) :
+            _table(table), _path(path) { _table.beginLoad(_path); }
+        ~Loading() { _table.endLoad(_path); }
+    private:
+        FileTable& _table;
+        std::string _path;
+    };
+
+private:
+    enum { SHARDS = 64 };
+
+    struct Shard {
+        boost::mutex mutex;
+        boost::condition_variable unblocked;
+        boost::unordered_map<std::string, OpenFile*> files;
+        boost::unordered_map<std::string, int> loading;//正在载入的次数
+        boost::unordered_map<std::string, int> blocked;//占用该路径的克隆数
+    };
+
+    Shard& shard(const std::string& path);
+
+    // 锁住file当前所在的分片
+    Shard& lockShard(OpenFile* file, boost::mutex::scoped_lock& lock);
+
+    Shard _shards[SHARDS];
+    boost::mutex _path_mutex;//保护OpenFile::path，修改时还须持有新旧路径所在分片的锁
+};
+
+#endif
@@ -1,85 +1,407 @@
-﻿/*
+﻿/*
  *  Copyright 2009 Michael Stephens
- *  Copyright 2014 陈亚兴（Modified/Updated）
- *
- *  This program is free software: you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License as published by
- *  the Free Software Foundation, either version 3 of the License, or
- *  (at your option) any later version.
- *
- *  This program is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  GNU General Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License
- *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  Copyright 2014 陈亚兴（Modified/Updated）
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
 #include "local_gridfile.h"
+#include "checksum.h"
 
 #include <algorithm>
+#include <errno.h>
+
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 
-int LocalGridFile::write(const char *buf, size_t nbyte, off_t offset)
+static long long write_budget = 0;
+static long long resident_bytes = 0;
+static boost::mutex budget_mutex;
+
+static void account(long long bytes)
 {
-    int last_chunk = (offset + nbyte) / _chunkSize;
-    int written = 0;
+    boost::mutex::scoped_lock lock(budget_mutex);
+    resident_bytes += bytes;
+}
 
-    while(last_chunk > _chunks.size() - 1) {
-        char *new_buf = new char[_chunkSize];
-        memset(new_buf, 0, _chunkSize);
-        _chunks.push_back(new_buf);
+static bool over_budget(long long bytes)
+{
+    boost::mutex::scoped_lock lock(budget_mutex);
+    return write_budget > 0 && resident_bytes + bytes > write_budget;
+}
+
+void LocalGridFile::setWriteBudget(long long bytes)
+{
+    boost::mutex::scoped_lock lock(budget_mutex);
+    write_budget = bytes;
+}
+
+LocalGridFile::~LocalGridFile()
+{
+    while(!_chunks.empty()) {
+        freeChunk(_chunks.begin());
     }
+    delete _spill;
+    delete _backend;
+    delete _checksum;
+}
 
-    int chunk_num = offset / _chunkSize;
-    char* dest_buf = _chunks[chunk_num];
+int LocalGridFile::write(const char *buf, size_t nbyte, off_t offset)
+{
+    if(!nbyte) {
+        return 0;
+    }
 
+    int chunk_num = offset / _chunkSize;
+    int first_chunk = chunk_num;
     int buf_offset = offset % _chunkSize;
-    if(buf_offset) {
-        dest_buf += offset % _chunkSize;
-        int to_write = min(nbyte - written,
-                           (long unsigned int)(_chunkSize - buf_offset));
-        memcpy(dest_buf, buf, to_write);
-        written += to_write;
-        chunk_num++;
-    }
+    size_t written = 0;
+    int res = 0;
 
     while(written < nbyte) {
-        dest_buf = _chunks[chunk_num];
         int to_write = min(nbyte - written,
-                           (long unsigned int)_chunkSize);
-        memcpy(dest_buf, buf, to_write);
+                           (size_t)(_chunkSize - buf_offset));
+        // a chunk this write covers completely needs no zeroing or fetch
+        char* dest_buf;
+        res = loadChunk(chunk_num, to_write < _chunkSize, dest_buf);
+        if(res != 0) {
+            break;
+        }
+        memcpy(dest_buf + buf_offset, buf + written, to_write);
+        _chunks[chunk_num].dirty = true;
         written += to_write;
+        buf_offset = 0;
         chunk_num++;
     }
 
-    _length = max(_length, (int)offset + written);
+    if(!written) {
+        return res;
+    }
+
+    _length = max(_length, offset + (off_t)written);
     _dirty = true;
-    
+
+    if(_checksum) {
+        _checksum->update(offset, buf, written);
+    }
+
+    if(_streaming) {
+        sealChunks(first_chunk, (offset + written) / _chunkSize);
+    }
+
     return written;
 }
 
 int LocalGridFile::read(char* buf, size_t size, off_t offset)
 {
+    if(offset >= _length) {
+        return 0;
+    }
+
+    size = min(size, (size_t)(_length - offset));
     size_t len = 0;
-    int chunk_num = offset / _chunkSize;
 
-    while(len < size && chunk_num < _chunks.size()) {
-        const char* chunk = _chunks[chunk_num];
-        size_t to_read = min((size_t)_chunkSize, size - len);
+    while(len < size) {
+        int chunk_num = (offset + len) / _chunkSize;
+        int chunk_off = (offset + len) % _chunkSize;
+        size_t to_read = min((size_t)(_chunkSize - chunk_off), size - len);
 
-        if(!len && offset) {
-            chunk += offset % _chunkSize;
-            to_read = min(to_read,
-                          (size_t)(_chunkSize - (offset % _chunkSize)));
+        if(_chunks.count(chunk_num) ||
+           (off_t)chunk_num * _chunkSize < _storedLength) {
+            char *data;
+            int res = loadChunk(chunk_num, true, data);
+            if(res != 0) {
+                return len ? (int)len : res;
+            }
+            memcpy(buf + len, data + chunk_off, to_read);
+        } else {
+            memset(buf + len, 0, to_read);
         }
 
-        memcpy(buf + len, chunk, to_read);
         len += to_read;
-        chunk_num++;
     }
 
     return len;
 }
+
+int LocalGridFile::truncate(off_t length)
+{
+    // zero the rest of the boundary chunk, fetching it if only stored
+    int tail = length % _chunkSize;
+    int n = length / _chunkSize;
+    if(length < _length && tail &&
+       (_chunks.count(n) || (off_t)n * _chunkSize < _storedLength)) {
+        char *buf;
+        int res = loadChunk(n, true, buf);
+        if(res != 0) {
+            return res;
+        }
+        memset(buf + tail, 0, _chunkSize - tail);
+        _chunks[n].dirty = true;
+    }
+
+    if(_checksum) {
+        _checksum->truncate(length);
+    }
+    _dirty = true;
+
+    if(length >= _length) {
+        // the new tail is a hole until written
+        _length = length;
+        return 0;
+    }
+
+    int numChunks = (length + _chunkSize - 1) / _chunkSize;
+    ChunkMap::iterator i = _chunks.lower_bound(numChunks);
+    while(i != _chunks.end()) {
+        freeChunk(i++);
+    }
+
+    _length = length;
+    if(_storedLength > length) {
+        _storedLength = length;
+        if(_backend) {
+            return _backend->truncate(numChunks);
+        }
+    }
+
+    return 0;
+}
+
+char* LocalGridFile::getChunk(int n)
+{
+    ChunkMap::iterator i = _chunks.find(n);
+    return i == _chunks.end() ? NULL : i->second.data;
+}
+
+int LocalGridFile::getChunkLength(int n)
+{
+    off_t start = (off_t)n * _chunkSize;
+    if(start >= _length) {
+        return 0;
+    }
+
+    return min((off_t)_chunkSize, _length - start);
+}
+
+bool LocalGridFile::chunkDirty(int n)
+{
+    ChunkMap::iterator i = _chunks.find(n);
+    return i != _chunks.end() && i->second.dirty;
+}
+
+void LocalGridFile::getDirtyChunks(vector<int>& chunks)
+{
+    for(ChunkMap::iterator i = _chunks.begin(); i != _chunks.end(); i++) {
+        if(i->second.dirty) {
+            chunks.push_back(i->first);
+        }
+    }
+}
+
+void LocalGridFile::flushed()
+{
+    for(ChunkMap::iterator i = _chunks.begin(); i != _chunks.end(); i++) {
+        i->second.dirty = false;
+    }
+    _storedLength = _length;
+    _dirty = false;
+}
+
+bool LocalGridFile::rechunk(int chunkSize)
+{
+    if(chunkSize == _chunkSize) {
+        return true;
+    }
+    if(_storedLength > 0) {
+        return false;
+    }
+
+    // copy into a file of the new size, releasing each old chunk as soon
+    // as it is copied so at most one extra chunk is held; holes stay holes
+    LocalGridFile sliced(chunkSize);
+    sliced._overcommit = true;
+    while(!_chunks.empty()) {
+        ChunkMap::iterator i = _chunks.begin();
+        sliced.write(i->second.data, getChunkLength(i->first),
+                     (off_t)i->first * _chunkSize);
+        freeChunk(i);
+    }
+
+    // take over the new chunks; the old (now empty) state goes with sliced
+    std::swap(_chunkSize, sliced._chunkSize);
+    _chunks.swap(sliced._chunks);
+    _lru.swap(sliced._lru);
+    std::swap(_spill, sliced._spill);
+
+    return true;
+}
+
+bool LocalGridFile::adopt(int chunkSize, off_t length)
+{
+    if(_length > 0 || !_chunks.empty()) {
+        return false;
+    }
+
+    // the spill file is sized for the old chunks
+    delete _spill;
+    _spill = NULL;
+
+    _chunkSize = chunkSize;
+    _length = _storedLength = length;
+    _dirty = true;
+    if(_checksum) {
+        _checksum->truncate(length);
+    }
+
+    return true;
+}
+
+// Sets buf to the buffer of chunk n, making it resident if needed. With
+// fetch the stored contents are read back from the backend, otherwise the
+// caller is about to overwrite the whole chunk. Returns 0, -ENOSPC if no
+// buffer can be had within the budget or -EIO if the stored chunk cannot
+// be read; the chunk is then left out of the cache.
+int LocalGridFile::loadChunk(int n, bool fetch, char*& buf)
+{
+    ChunkMap::iterator i = _chunks.find(n);
+    if(i != _chunks.end()) {
+        if(!i->second.spilled) {
+            _lru.splice(_lru.end(), _lru, i->second.lru);
+        }
+        buf = i->second.data;
+        return 0;
+    }
+
+    Chunk *chunk = allocChunk(n, fetch);
+    if(!chunk) {
+        return -ENOSPC;
+    }
+
+    buf = chunk->data;
+    if(fetch && _backend && (off_t)n * _chunkSize < _storedLength) {
+        if(_backend->sync() != 0 || _backend->fetch(n, buf, _chunkSize) < 0) {
+            freeChunk(_chunks.find(n));
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
+// Uploads the full chunks in [first, last) that the writer has moved past
+// and frees their buffers, so a sequential writer only keeps the tail chunk
+// plus the backend's in-flight window in memory.
+void LocalGridFile::sealChunks(int first, int last)
+{
+    ChunkMap::iterator i = _chunks.lower_bound(first);
+    while(i != _chunks.end() && i->first < last) {
+        off_t end = (off_t)(i->first + 1) * _chunkSize;
+        if(!i->second.dirty || end > _length) {
+            i++;
+            continue;
+        }
+
+        _backend->upload(i->first, i->second.data, _chunkSize);
+        _storedLength = max(_storedLength, end);
+        freeChunk(i++);
+    }
+}
+
+// Gives chunk n a buffer from the pool, zeroed unless the caller is about
+// to overwrite all of it. Over the write budget this file's coldest heap
+// chunks are released (clean ones can be fetched again) or spilled first;
+// if that is not enough the new chunk is placed in the spill file directly.
+// Returns NULL when the spill file cannot take it, unless overcommitting.
+LocalGridFile::Chunk* LocalGridFile::allocChunk(int n, bool zero)
+{
+    char *buf = NULL;
+
+    if(over_budget(_chunkSize)) {
+        while(!_lru.empty() && over_budget(_chunkSize)) {
+            ChunkMap::iterator cold = _chunks.find(_lru.front());
+            if(!cold->second.dirty &&
+               (off_t)cold->first * _chunkSize < _storedLength) {
+                freeChunk(cold);
+            } else if(!spillChunk(cold->first)) {
+                break;
+            }
+        }
+
+        if(over_budget(_chunkSize)) {
+            if(!_spill) {
+                _spill = new SpillFile(_chunkSize);
+            }
+            buf = _spill->map();
+            if(!buf && !_overcommit) {
+                return NULL;
+            }
+        }
+    }
+
+    Chunk &chunk = _chunks[n];
+    if(buf) {
+        chunk.spilled = true;
+    } else {
+        buf = ChunkPool::get(_chunkSize).alloc();
+        account(_chunkSize);
+        chunk.lru = _lru.insert(_lru.end(), n);
+    }
+
+    if(zero) {
+        memset(buf, 0, _chunkSize);
+    }
+    chunk.data = buf;
+
+    return &chunk;
+}
+
+void LocalGridFile::freeChunk(ChunkMap::iterator i)
+{
+    Chunk &chunk = i->second;
+    if(chunk.spilled) {
+        _spill->unmap(chunk.data);
+    } else {
+        ChunkPool::get(_chunkSize).release(chunk.data);
+        account(-_chunkSize);
+        _lru.erase(chunk.lru);
+    }
+
+    _chunks.erase(i);
+}
+
+// Moves heap chunk n into the spill file, keeping its contents.
+bool LocalGridFile::spillChunk(int n)
+{
+    if(!_spill) {
+        _spill = new SpillFile(_chunkSize);
+    }
+
+    char *buf = _spill->map();
+    if(!buf) {
+        return false;
+    }
+
+    Chunk &chunk = _chunks[n];
+    memcpy(buf, chunk.data, _chunkSize);
+    ChunkPool::get(_chunkSize).release(chunk.data);
+    account(-_chunkSize);
+    _lru.erase(chunk.lru);
+
+    chunk.data = buf;
+    chunk.spilled = true;
+
+    return true;
+}
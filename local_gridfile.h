@@ -1,59 +1,158 @@
-﻿/*
+﻿/*
  *  Copyright 2009 Michael Stephens
- *  Copyright 2014 陈亚兴（Modified/Updated）
- *
- *  This program is free software: you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License as published by
- *  the Free Software Foundation, either version 3 of the License, or
- *  (at your option) any later version.
- *
- *  This program is distributed in the hope that it will be useful,
- *  but WITHOUT ANY WARRANTY; without even the implied warranty of
- *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- *  GNU General Public License for more details.
- *
- *  You should have received a copy of the GNU General Public License
- *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  Copyright 2014 陈亚兴（Modified/Updated）
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
 #ifndef _LOCAL_GRIDFILE_H
 #define _LOCAL_GRIDFILE_H
 
+#include "spill_file.h"
+#include "chunk_pool.h"
+#include <map>
+#include <list>
 #include <vector>
 #include <cstring>
 #include <iostream>
 
+#include <boost/thread/mutex.hpp>
+
 const unsigned int DEFAULT_CHUNK_SIZE = 256 * 1024;
+// a chunk document must stay below the 16MB BSON limit
+const unsigned int MAX_CHUNK_SIZE = 15 * 1024 * 1024;
+
+class StreamChecksum;
+
+// Persistent storage behind a LocalGridFile. Chunks that have been handed
+// to upload() may be dropped from memory and are read back with fetch().
+class ChunkBackend {
+public:
+    virtual ~ChunkBackend() {}
+
+    // queue chunk n for storage; data is copied before this returns
+    virtual void upload(int n, const char* data, int len) = 0;
+    // read the stored contents of chunk n, returns the number of bytes
+    // or -errno
+    virtual int fetch(int n, char* buf, int size) = 0;
+    // wait for queued uploads, returns 0 or -errno; once an upload has
+    // failed every later call fails too, the chunk is lost
+    virtual int sync() = 0;
+    // drop stored chunks numChunks and up, returns 0 or -errno
+    virtual int truncate(int numChunks) = 0;
+};
 
 class LocalGridFile {
 public:
-    LocalGridFile(int chunkSize = DEFAULT_CHUNK_SIZE) :
-    _chunkSize(chunkSize), _length(0), _dirty(true) {
-          _chunks.push_back(new char[_chunkSize]);
+    // length is the size of an existing file already held by the backend;
+    // its chunks are fetched on first read or partial write
+    LocalGridFile(int chunkSize = DEFAULT_CHUNK_SIZE, off_t length = 0) :
+    _chunkSize(chunkSize), _length(length), _storedLength(length), _dirty(true),
+    _streaming(false), _backend(NULL), _checksum(NULL), _spill(NULL),
+    _overcommit(false) {
       }
 
-    ~LocalGridFile() {
-		
-        for(std::vector<char*>::iterator i = _chunks.begin();
-            i != _chunks.end(); i++) {
-            delete *i;
-        }
-    }
+    ~LocalGridFile();
 
     int getChunkSize() { return _chunkSize; }
-    int getNumChunks() { return _chunks.size(); }
-    int getLength() { return _length; }
-    char* getChunk(int n) { return _chunks[n]; }
+    int getNumChunks() { return (_length + _chunkSize - 1) / _chunkSize; }
+    off_t getLength() { return _length; }
+    // resident data of chunk n, NULL for holes and released chunks
+    char* getChunk(int n);
+    int getChunkLength(int n);
     bool dirty() { return _dirty; }
-    void flushed() { _dirty = false; }
+    bool chunkDirty(int n);
+    void getDirtyChunks(std::vector<int>& chunks);
+    // everything written so far is stored in the backend
+    void flushed();
+    // the contents were stored outside the backend (inline in the node);
+    // chunks stay dirty so they are neither dropped nor skipped later
+    void flushedInline() { _dirty = false; }
+    off_t getStoredLength() { return _storedLength; }
+    // re-slices the buffered data into chunks of another size; only
+    // possible while the backend holds nothing of this file
+    bool rechunk(int chunkSize);
+    // takes over length bytes of chunkSize chunks that were placed in the
+    // backend behind this file's back (a server-side copy); only possible
+    // while the file is empty. Leaves the file dirty so it gets flushed
+    bool adopt(int chunkSize, off_t length);
 
+    // takes ownership of backend; with streaming, chunks the writer has
+    // moved past are uploaded and released while the file is still open
+    void setBackend(ChunkBackend* backend, bool streaming) {
+        _backend = backend;
+        _streaming = streaming;
+    }
+    ChunkBackend* getBackend() { return _backend; }
+
+    // takes ownership; every write is fed to it
+    void setChecksum(StreamChecksum* checksum) { _checksum = checksum; }
+    StreamChecksum* getChecksum() { return _checksum; }
+    int sync() { return _backend ? _backend->sync() : 0; }
+
+    // held by callers while they read, write or flush this file
+    boost::mutex& getMutex() { return _mutex; }
+
+    // limit on chunk memory held by all open files together, 0 for none;
+    // past it the coldest chunks of the growing file move to a SpillFile
+    static void setWriteBudget(long long bytes);
+
+    // both return the number of bytes done, or -errno if none were:
+    // -ENOSPC past the write budget with no usable spill file, -EIO when
+    // a stored chunk cannot be read back
     int write(const char* buf, size_t nbyte, off_t offset);
     int read(char* buf, size_t size, off_t offset);
+    // cuts or extends the file to length; chunks past the end are
+    // dropped here and in the backend, only the boundary chunk becomes
+    // dirty. Returns 0 or -errno
+    int truncate(off_t length);
 
 private:
-    int _chunkSize, _length;
+    struct Chunk {
+        Chunk() : data(NULL), dirty(false), spilled(false) {}
+        char* data;
+        bool dirty;
+        // lives in _spill instead of on the heap
+        bool spilled;
+        std::list<int>::iterator lru;
+    };
+    typedef std::map<int, Chunk> ChunkMap;
+
+    int _chunkSize;
+    off_t _length;
+    // bytes the backend may hold data for; chunks past it that are not
+    // resident are holes and read as zeros
+    off_t _storedLength;
     bool _dirty;
-    std::vector<char*> _chunks;
+    // resident chunks only, holes take no memory
+    ChunkMap _chunks;
+    bool _streaming;
+    ChunkBackend* _backend;
+    StreamChecksum* _checksum;
+    // heap chunks, least recently used first
+    std::list<int> _lru;
+    SpillFile* _spill;
+    // take heap buffers past the budget when the spill file fails; only
+    // for copies that free an old chunk for every new one
+    bool _overcommit;
+    boost::mutex _mutex;
+
+    Chunk* allocChunk(int n, bool zero);
+    void freeChunk(ChunkMap::iterator i);
+    bool spillChunk(int n);
+    int loadChunk(int n, bool fetch, char*& buf);
+    void sealChunks(int first, int last);
 };
 
 #endif
@@ -19,35 +19,50 @@
 #include "operations.h"
 #include "options.h"
 #include "utils.h"
+#include "checksum.h"
+#include "chunk_codec.h"
+#include "local_gridfile.h"
 #include <cstring>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
 
 using namespace std;
 
+#ifndef METADATA_WORKERS
+#define METADATA_WORKERS 4 //--data_ops之外为元数据操作保留的工作线程数
+#endif
+
 int main(int argc, char *argv[])
 {
     static struct fuse_operations gridfs_oper;
+    gridfs_oper.init = gridfs_init;
     gridfs_oper.getattr = gridfs_getattr;
     gridfs_oper.readdir = gridfs_readdir;
 	gridfs_oper.access = gridfs_access;
     gridfs_oper.open = gridfs_open;
-    //gridfs_oper.create = gridfs_create;
+    gridfs_oper.create = gridfs_create;
 	gridfs_oper.mknod = gridfs_mknod;
     gridfs_oper.release = gridfs_release;
     gridfs_oper.unlink = gridfs_unlink;
     gridfs_oper.read = gridfs_read;
 	/*
     gridfs_oper.listxattr = gridfs_listxattr;
-	
-    gridfs_oper.getxattr = gridfs_getxattr;
 	*/
+    gridfs_oper.getxattr = gridfs_getxattr;
     gridfs_oper.setxattr = gridfs_setxattr;
 	
     gridfs_oper.write = gridfs_write;
     gridfs_oper.flush = gridfs_flush;
+    gridfs_oper.fsync = gridfs_fsync;
+    gridfs_oper.fsyncdir = gridfs_fsyncdir;
     gridfs_oper.rename = gridfs_rename;
 	gridfs_oper.mkdir = gridfs_mkdir;
 	gridfs_oper.rmdir = gridfs_rmdir;
 	gridfs_oper.truncate = gridfs_truncate;
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 4)
+	gridfs_oper.copy_file_range = gridfs_copy_file_range;
+#endif
 	
 	gridfs_oper.chown = gridfs_chown;
 	gridfs_oper.chmod = gridfs_chmod;
@@ -56,6 +71,13 @@ int main(int argc, char *argv[])
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
     memset(&gridfs_options, 0, sizeof(struct gridfs_options));
+    gridfs_options.upload_window = 4;
+    gridfs_options.upload_threads = 4;
+    gridfs_options.write_budget = 1024;
+    gridfs_options.flush_batch = 16;
+    gridfs_options.flush_threads = 4;
+    gridfs_options.chunk_size = DEFAULT_CHUNK_SIZE >> 10;
+    gridfs_options.io_threads = 8;
     if(fuse_opt_parse(&args, &gridfs_options, gridfs_opts,
                       gridfs_opt_proc) == -1)
     {
@@ -68,6 +90,52 @@ int main(int argc, char *argv[])
     if(!gridfs_options.db) {
         gridfs_options.db = "test";
     }
+    if(!gridfs_options.spill_dir) {
+        gridfs_options.spill_dir = "/var/tmp";
+    }
+    if(!gridfs_options.checksum) {
+        gridfs_options.checksum = "md5";
+    }
+    if(!gridfs_options.compress) {
+        gridfs_options.compress = "none";
+    }
+
+    StreamChecksum::Type checksum_type;
+    if(!StreamChecksum::parseType(gridfs_options.checksum, checksum_type)) {
+        cout << "Error: unsupported checksum: " << gridfs_options.checksum << endl;
+        return -1;
+    }
+    ChunkCodec::Type codec;
+    if(!ChunkCodec::parseType(gridfs_options.compress, codec)) {
+        cout << "Error: unsupported codec: " << gridfs_options.compress << endl;
+        return -1;
+    }
+    if(gridfs_options.chunk_size <= 0 ||
+       gridfs_options.chunk_size > (int)(MAX_CHUNK_SIZE >> 10)) {
+        cout << "Error: chunk_size must be between 1 and "
+             << (MAX_CHUNK_SIZE >> 10) << " KB" << endl;
+        return -1;
+    }
+    if(gridfs_options.adaptive_chunks && gridfs_options.upload_window > 0) {
+        cout << "Note: --adaptive_chunks uploads files on close, "
+             << "ignoring --upload_window" << endl;
+        gridfs_options.upload_window = 0;
+    }
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 12)
+    if(gridfs_options.data_ops > 0) {
+        //插在最前，命令行中显式给出的-o max_threads仍然优先
+        ostringstream max_threads;
+        max_threads << "-omax_threads="
+                    << max(10, gridfs_options.data_ops + METADATA_WORKERS);
+        fuse_opt_insert_arg(&args, 1, max_threads.str().c_str());
+    }
+#endif
+#ifndef HAVE_OPENSSL
+    if(gridfs_options.dedup) {
+        cout << "Error: --dedup requires OpenSSL" << endl;
+        return -1;
+    }
+#endif
 
     return fuse_main(args.argc, args.argv, &gridfs_oper, NULL);
 }
@@ -20,8 +20,16 @@
 #include "options.h"
 #include "utils.h"
 #include "local_gridfile.h"
+#include "chunk_store.h"
+#include "checksum.h"
+#include "file_table.h"
+#include "conn_pool.h"
+#include "async_query.h"
+#include "chunk_pool.h"
 #include <algorithm>
+#include <vector>
 #include <cerrno>
+#include <cstring>
 #include <fcntl.h>
 
 #include <mongo/s/chunk.h>
@@ -30,7 +38,9 @@
 #include <mongo/client/connpool.h>
 
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/bind.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -42,14 +52,28 @@
 
 #define DEBUG
 
-#ifndef BLOCK_SIZE
-#define BLOCK_SIZE (256*1024)
-#endif
 
 #ifndef MAX_PATH_SIZE
 #define MAX_PATH_SIZE 1024
 #endif
 
+#ifndef ADAPTIVE_CHUNKS
+#define ADAPTIVE_CHUNKS 1024 //自适应块大小时每个文件的目标块数
+#endif
+
+#ifndef ADAPTIVE_MAX_CHUNK
+#define ADAPTIVE_MAX_CHUNK (4*1024*1024)
+#endif
+
+#ifndef MIN_XATTR_CHUNK
+#define MIN_XATTR_CHUNK 4096 //目录块大小属性的下限，块大小须为其整数倍（页对齐）
+#endif
+
+#define CHUNK_SIZE_XATTR "user.gridfs.chunk_size"
+#define COPY_FROM_XATTR "user.gridfs.copy_from" //在服务器端复制文件内容
+#define CLONE_FROM_XATTR "user.gridfs.clone_from" //克隆文件（共用同一文件文档）
+#define POOL_STATS_XATTR "user.gridfs.pool_stats" //连接池等待时间统计（只读）
+
 #ifndef WRONLY_MASK
 #define WRONLY_MASK 128 //(--w-------)
 #endif
@@ -66,24 +90,447 @@
 using namespace std;
 using namespace mongo;
 
-boost::unordered_map<string, LocalGridFile*> open_files;//储存已打开的文件列表
+FileTable open_files;//已打开的文件（按路径分片加锁）
 
-boost::unordered_map<string, mode_t> file_mode_s;//储存文件权限
-
-unsigned int FH = 1;//储存文件句柄
+boost::recursive_mutex nlink_io_mutex;
 
-boost::recursive_mutex flush_io_mutex;
+static WorkQueue* flush_queue = NULL;//后台flush线程池，以已打开文件的当前路径为key
 
-boost::recursive_mutex map_io_mutex;
+static boost::mutex flush_error_mutex;
+static boost::unordered_map<string, int> flush_errors;//后台flush失败的文件及错误号，文件关闭后仍保留至下一次open或fsync
 
-boost::recursive_mutex nlink_io_mutex;
+static int flush_file(const string& path_str, LocalGridFile* lgf, mode_t mode);
+static void init_stat_lookup();
+
+/**
+ * 由文件句柄取得已打开文件，句柄为0（只读打开未在写入的文件）时返回NULL
+ * fi：已打开文件信息
+ **/
+static inline OpenFile* open_file_of(struct fuse_file_info* fi)
+{
+	return (OpenFile*)(uintptr_t)fi->fh;
+}
+
+/**
+ * 以已打开文件设置文件句柄，该次打开持有的引用在gridfs_release中释放
+ * fi：已打开文件信息
+ * file：已打开文件
+ **/
+static inline void set_open_file(struct fuse_file_info* fi, OpenFile* file)
+{
+	fi->fh = (uint64_t)(uintptr_t)file;
+}
+
+static void release_job(string path, LocalGridFile* lgf);
+
+/**
+ * 释放对已打开文件的一个引用：最后一个引用释放时，在该文件尚未完成的flush之后释放内存
+ * file：已打开文件
+ **/
+static void put_open_file(OpenFile* file)
+{
+	if(!open_files.release(file)){
+		return;//其他打开仍在使用
+	}
+
+	if(flush_queue != NULL && !file->path.empty()){
+		flush_queue->post(file->path,boost::bind(release_job,file->path,file->lgf));
+	}else{
+		delete file->lgf;//释放lgf指针指向的内存（被重命名覆盖的文件没有排队的flush）
+	}
+	delete file;
+}
+
+/**
+ * flush线程池中的任务：写入文件，失败时记录错误供fsync或下一次open返回
+ * 任务持有文件的一个引用，文件的释放任务只会在其后提交
+ * path：文件路径
+ * file：已打开文件
+ **/
+static void flush_job(string path, OpenFile* file)
+{
+	//提交之后被重命名覆盖的文件不再写回，否则会覆盖移入的文件
+	int res = open_files.path(file).empty() ? 0 : flush_file(path,file->lgf,file->mode);
+	if(res != 0){
+		//close已经返回，调用者无法得知写入失败
+		cout<<"[FLUSH]: Error = cannot write back \""<<path<<"\": "<<strerror(-res)
+			<<", reported at its next open or fsync"<<endl;
+		boost::mutex::scoped_lock lock(flush_error_mutex);
+		flush_errors[path] = res;
+	}
+	put_open_file(file);
+}
+
+/**
+ * 释放已打开文件（排在该文件之前提交的flush任务之后执行），flush的错误仍保留
+ * path：文件路径
+ * lgf：已打开文件
+ **/
+static void release_job(string path, LocalGridFile* lgf)
+{
+	delete lgf;
+}
+
+/**
+ * 取出并清除文件最近一次后台flush的错误
+ * path：文件路径
+ **/
+static int take_flush_error(const char* path)
+{
+	boost::mutex::scoped_lock lock(flush_error_mutex);
+	boost::unordered_map<string,int>::iterator err_iter = flush_errors.find(path);
+	if(err_iter == flush_errors.end()){
+		return 0;
+	}
+
+	int res = err_iter->second;
+	flush_errors.erase(err_iter);
+	return res;
+}
+
+/**
+ * 等待文件尚未完成的后台flush，使其在GridFS中可见
+ * path：文件路径
+ **/
+static void wait_flush(const char* path)
+{
+	if(flush_queue != NULL){
+		flush_queue->wait(path);
+	}
+}
+
+/**
+ * 等待目录下文件尚未完成的后台flush
+ * path：目录路径
+ * subtree：是否包括各级子目录中的文件（重命名目录时需要），否则只等待直接子项
+ **/
+static void wait_flush_dir(const char* path, bool subtree = false)
+{
+	if(flush_queue != NULL){
+		string prefix(path);
+		if(prefix != "/"){
+			prefix += "/";
+		}
+		if(subtree){
+			flush_queue->waitPrefix(prefix);
+		}else{
+			flush_queue->waitChildren(prefix);
+		}
+	}
+}
 
+/**
+ * 祖先目录路径（根目录不在fs.nodes中）
+ * path：文件路径
+ **/
+static BSONArray ancestor_paths(const char* path)
+{
+	BSONArrayBuilder ancestors;
+	string path_str(path);
+	size_t pos = path_str.rfind('/');
+	while(pos != string::npos && pos > 0){
+		path_str = path_str.substr(0,pos);
+		ancestors.append(path_str);
+		pos = path_str.rfind('/');
+	}
+	return ancestors.arr();
+}
+
+/**
+ * 新文件的块大小：取最近的设置了chunk_size的祖先目录，均未设置时为挂载选项
+ * path：文件路径
+ **/
+static int chunk_size_for(DBClientBase& conn, const char* path)
+{
+	string nodes_ns = string(gridfs_options.db)+string(".fs.nodes");//节点命名空间
+	auto_ptr<DBClientCursor> cursor = conn.query(nodes_ns,
+			Query(BSON("abs_path" << BSON("$in" << ancestor_paths(path)) <<
+					   "meta_data.chunk_size" << BSON("$exists" << true))).sort("depth",-1),1);
+	if(cursor->more()){
+		BSONObj dir_obj = cursor->next();
+		return dir_obj.getObjectField("meta_data").getIntField("chunk_size");
+	}
+	return gridfs_options.chunk_size << 10;
+}
+
+/**
+ * 按文件长度自适应的块大小：块数较多时加倍块大小（最大4MB）
+ * length：文件长度
+ * chunk_size：原块大小
+ **/
+static int adaptive_chunk_size(long long length, int chunk_size)
+{
+	while(chunk_size < ADAPTIVE_MAX_CHUNK && length / chunk_size > ADAPTIVE_CHUNKS){
+		chunk_size *= 2;
+	}
+	return chunk_size;
+}
+
+/**
+ * 为以写方式打开的文件创建本地缓存，并关联其在GridFS中的存储
+ * file_id：文件id（新文件为新生成的id）
+ * chunk_size：块大小
+ * length：已存储的文件长度，其块在首次读取或部分写入时才从fs.chunks取回
+ **/
+static LocalGridFile* new_local_gridfile(const OID& file_id, int chunk_size,
+                                         long long length = 0)
+{
+	LocalGridFile *lgf = new LocalGridFile(chunk_size,length);
+	//写入时计算校验和，只有从头顺序写入的文件才能使用
+	StreamChecksum::Type checksum_type;
+	if(StreamChecksum::parseType(gridfs_options.checksum,checksum_type) &&
+	   checksum_type != StreamChecksum::NONE){
+		lgf->setChecksum(new StreamChecksum(checksum_type));
+	}
+	//已写满的块在写入过程中即后台上传
+	lgf->setBackend(new GridChunkBackend(file_id,gridfs_options.upload_window),
+					upload_queue != NULL && gridfs_options.upload_window > 0);
+	return lgf;
+}
+
+/**
+ * 文件系统初始化（fuse完成daemon化之后调用，后台线程须在此创建）
+ * conn：fuse连接信息，在此协商内核功能
+ * cfg：fuse高层接口配置
+ **/
+void* gridfs_init(struct fuse_conn_info* conn, struct fuse_config* cfg)
+{
+	//写回缓存：内核合并小写入，关闭前不必每次write都进入用户态
+	if(gridfs_options.writeback_cache && (conn->capable & FUSE_CAP_WRITEBACK_CACHE)){
+		conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+	}
+	//splice：读写数据在内核与/dev/fuse之间移动页而不复制
+	if(gridfs_options.splice){
+		conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+	}
+	//readdirplus：列目录时一并返回属性，省去逐项lookup
+	if(gridfs_options.readdirplus && (conn->capable & FUSE_CAP_READDIRPLUS)){
+		conn->want |= FUSE_CAP_READDIRPLUS;
+		conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+	}else{
+		conn->want &= ~FUSE_CAP_READDIRPLUS;
+	}
+	//单个写请求的最大字节数，超过默认值时由libfuse向内核协商max_pages
+	if(gridfs_options.max_write > 0){
+		conn->max_write = gridfs_options.max_write << 10;
+	}
+	//内核同时发出的后台读写（预读、异步读、写回）上限，其余工作线程留给元数据操作
+	if(gridfs_options.data_ops > 0){
+		conn->max_background = gridfs_options.data_ops;
+		conn->congestion_threshold = max(1, gridfs_options.data_ops * 3 / 4);
+	}
+
+	//所有已打开文件的写缓存总量上限，超出后换出到临时文件
+	LocalGridFile::setWriteBudget((long long)gridfs_options.write_budget << 20);
+	SpillFile::setDirectory(gridfs_options.spill_dir);
+	init_write_concerns();
+	init_chunk_codec();
+
+	//连接池须在fuse转入后台之后建立连接；元数据操作与块数据传输各有连接名额
+	meta_pool.configure(gridfs_options.host,gridfs_options.meta_pool_size,gridfs_options.sticky_conns);
+	data_pool.configure(gridfs_options.host,gridfs_options.pool_size,gridfs_options.sticky_conns);
+	if(gridfs_options.pool_prewarm > 0){
+		meta_pool.prewarm(gridfs_options.pool_prewarm);//首批请求不必等待建立连接（两个连接池共用驱动的空闲连接）
+	}
+
+	if(gridfs_options.upload_window > 0 && gridfs_options.upload_threads > 0){
+		upload_queue = new WorkQueue(gridfs_options.upload_threads);
+	}
+	if(gridfs_options.flush_threads > 0){
+		flush_queue = new WorkQueue(gridfs_options.flush_threads);
+	}
+	if(gridfs_options.io_threads > 0){
+		io_queue = new WorkQueue(gridfs_options.io_threads);//互不依赖的查询并发执行
+	}
+	init_stat_lookup();
+	return NULL;
+}
+
+static bool stat_lookup = true;//服务器支持$lookup，不支持时改为两次查询（只在gridfs_init中设置）
+
+/**
+ * 挂载时以一次空的聚合探测服务器是否支持$lookup，之后只读stat_lookup
+ **/
+static void init_stat_lookup()
+{
+	try{
+		PooledConnection sdc(meta_pool);
+		BSONObj pipeline = BSON_ARRAY(
+			BSON("$match" << BSON("abs_path" << "")) <<
+			BSON("$limit" << 1) <<
+			BSON("$lookup" << BSON("from" << "fs.files" << "localField" << "meta_data.file_id" <<
+								   "foreignField" << "_id" << "as" << "file")));
+		BSONObj res;
+		stat_lookup = sdc.conn().runCommand(gridfs_options.db,BSON("aggregate" << "fs.nodes" <<
+											"pipeline" << pipeline << "cursor" << BSONObj()),res);
+		#ifdef DEBUG
+			if(!stat_lookup){
+				printf("[INIT]: $lookup UNSUPPORTED = %s\n",res.getStringField("errmsg"));
+			}
+		#endif
+		sdc.done();
+	}catch(DBException &e){
+		//服务器暂时不可用时仍按支持处理，每次聚合失败时退回两次查询
+		cout<<"[INIT]: Error = "<<e.what()<<endl;
+	}
+}
+
+/**
+ * 一次聚合查询取得节点及其文件文档：$lookup按meta_data.file_id连接fs.files，只投影stat所需的字段
+ * （需要MongoDB 3.4及以上，不支持时退回先查节点、再查文件的两次查询）
+ * conn：mongodb连接
+ * path：文件路径
+ * node：返回节点文档，不存在时为空
+ * file：返回文件文档，目录、内联文件或文件文档不存在时为空
+ * is_inline：返回是否为内联存储的小文件
+ **/
+static void stat_node(DBClientBase& conn, const char* path, BSONObj& node, BSONObj& file, bool& is_inline)
+{
+	string db_name = gridfs_options.db;//获取数据库名
+	node = BSONObj();
+	file = BSONObj();
+	is_inline = false;
+
+	if(stat_lookup){
+		BSONObj pipeline = BSON_ARRAY(
+			BSON("$match" << BSON("abs_path" << path)) <<
+			BSON("$limit" << 1) <<
+			BSON("$lookup" << BSON("from" << "fs.files" << "localField" << "meta_data.file_id" <<
+								   "foreignField" << "_id" << "as" << "file")) <<
+			BSON("$project" << BSON("type" << 1 << "meta_data.mode" << 1 << "meta_data.nlink" << 1 <<
+									"meta_data.uid" << 1 << "meta_data.gid" << 1 <<
+									"meta_data.atime" << 1 << "meta_data.mtime" << 1 << "meta_data.ctime" << 1 <<
+									"meta_data.chunk_size" << 1 << "meta_data.length" << 1 <<
+									//内联数据本身不必传回
+									"inline" << BSON("$ne" << BSON_ARRAY(BSON("$type" << "$meta_data.inline") << "missing")) <<
+									"file.length" << 1 << "file.chunkSize" << 1 << "file.uploadDate" << 1)));
+		BSONObj res;
+		if(conn.runCommand(db_name,BSON("aggregate" << "fs.nodes" << "pipeline" << pipeline <<
+										"cursor" << BSONObj()),res)){
+			vector<BSONElement> batch = res.getObjectField("cursor").getField("firstBatch").Array();
+			if(!batch.empty()){
+				node = batch[0].Obj().getOwned();
+				is_inline = node.getBoolField("inline");
+				vector<BSONElement> files = node.getField("file").Array();
+				if(!files.empty()){
+					file = files[0].Obj().getOwned();
+				}
+			}
+			return;
+		}
+		#ifdef DEBUG
+			printf("[GETATTR]: AGGREGATE FAILED = %s\n",res.getStringField("errmsg"));
+		#endif
+	}
+
+	node = conn.findOne(db_name + ".fs.nodes",BSON("abs_path" << path));
+	BSONObj meta_data = node.getObjectField("meta_data");
+	is_inline = meta_data.hasField("inline");
+	if(!node.isEmpty() && node.getIntField("type") == 0 && !is_inline){
+		file = conn.findOne(db_name + ".fs.files",BSON("_id" << meta_data.getField("file_id")));
+	}
+}
+
+/**
+ * 由节点及其文件文档填写文件属性
+ * node：节点文档
+ * is_inline：是否为内联存储的小文件
+ * file：文件文档，目录及内联文件为空
+ * stbuf：描述linux系统中文件属性的结构
+ **/
+static int node_stat(const BSONObj& node, bool is_inline, const BSONObj& file, struct stat* stbuf)
+{
+	if(!node.isEmpty()){
+		int type = node.getIntField("type");
+		BSONObj metedata_obj = node.getObjectField("meta_data");
+		if(type==1){
+			//目录
+			stbuf->st_mode = S_IFDIR | metedata_obj.getIntField("mode");
+			stbuf->st_nlink = metedata_obj.getIntField("nlink");
+			if(metedata_obj.getIntField("uid") >= 0){
+				stbuf->st_uid = metedata_obj.getIntField("uid");
+			}
+			if(metedata_obj.getIntField("gid") >= 0){
+				stbuf->st_gid = metedata_obj.getIntField("gid");
+			}
+			stbuf->st_atime = metedata_obj.getField("atime").Date().toTimeT();
+			stbuf->st_mtime = metedata_obj.getField("mtime").Date().toTimeT();
+			stbuf->st_ctime = metedata_obj.getField("ctime").Date().toTimeT();
+        	stbuf->st_size = 1024;//设置目录的字节大小
+			//目录中新文件使用的块大小
+			stbuf->st_blksize = metedata_obj.hasField("chunk_size") ?
+								metedata_obj.getIntField("chunk_size") : gridfs_options.chunk_size << 10;
+			stbuf->st_blocks = 1;
+			return 0;//<---成功返回
+		}else if(type==0 && is_inline){
+			//内联存储的小文件，只需读取节点
+        	stbuf->st_mode = S_IFREG | metedata_obj.getIntField("mode");
+        	stbuf->st_nlink = metedata_obj.getIntField("nlink");
+			if(metedata_obj.getIntField("uid") >= 0){
+				stbuf->st_uid = metedata_obj.getIntField("uid");
+			}
+			if(metedata_obj.getIntField("gid") >= 0){
+				stbuf->st_gid = metedata_obj.getIntField("gid");
+			}
+			stbuf->st_atime = metedata_obj.getField("atime").Date().toTimeT();
+        	stbuf->st_ctime = metedata_obj.getField("ctime").Date().toTimeT();
+        	stbuf->st_mtime = metedata_obj.getField("mtime").Date().toTimeT();
+        	stbuf->st_size = metedata_obj.getField("length").numberLong();//设置文件的字节大小
+			stbuf->st_blksize = gridfs_options.chunk_size << 10;
+			stbuf->st_blocks = (stbuf->st_size + 511) / 512;
+        	return 0;//<--成功返回
+		}else if(type==0){
+			//文件
+			if(!file.isEmpty()){
+        		stbuf->st_mode = S_IFREG | metedata_obj.getIntField("mode");//设置文件模式为一般文件且权限为666（rw-rw-rw-)
+        		stbuf->st_nlink = metedata_obj.getIntField("nlink");//设置文件的连接数为1
+				if(metedata_obj.getIntField("uid") >= 0){
+					stbuf->st_uid = metedata_obj.getIntField("uid");
+				}
+				if(metedata_obj.getIntField("gid") >= 0){
+					stbuf->st_gid = metedata_obj.getIntField("gid");
+				}
+				stbuf->st_atime = metedata_obj.getField("atime").Date().toTimeT();
+        		stbuf->st_ctime = file.getField("uploadDate").Date().toTimeT();
+        		stbuf->st_mtime = metedata_obj.getField("mtime").Date().toTimeT();
+        		stbuf->st_size = file.getField("length").numberLong();//设置文件的字节大小
+				stbuf->st_blksize = file.getIntField("chunkSize");//文件的块大小
+				stbuf->st_blocks = (stbuf->st_size + 511) / 512;
+        		return 0;//<--成功返回
+			}else if(metedata_obj.getField("file_id").type() == jstOID){
+				//已创建但尚未写入过的文件（fs.files文档在首次flush时写入），视为空文件
+        		stbuf->st_mode = S_IFREG | metedata_obj.getIntField("mode");
+        		stbuf->st_nlink = metedata_obj.getIntField("nlink");
+				if(metedata_obj.getIntField("uid") >= 0){
+					stbuf->st_uid = metedata_obj.getIntField("uid");
+				}
+				if(metedata_obj.getIntField("gid") >= 0){
+					stbuf->st_gid = metedata_obj.getIntField("gid");
+				}
+				stbuf->st_atime = metedata_obj.getField("atime").Date().toTimeT();
+        		stbuf->st_ctime = metedata_obj.getField("ctime").Date().toTimeT();
+        		stbuf->st_mtime = metedata_obj.getField("mtime").Date().toTimeT();
+        		stbuf->st_size = 0;
+				stbuf->st_blksize = gridfs_options.chunk_size << 10;
+				stbuf->st_blocks = 0;
+        		return 0;//<--成功返回
+			}else{
+				return -ENOENT;//<--没有相应的文件或文件夹
+			}	
+		}	
+	}else{
+		return -ENOENT;//<--没有相应的文件或文件夹
+	}
+	return 0;
+}
+
 /**
  * 获取文件属性
  * path：文件路径
  * stbuf：描述linux系统中文件属性的结构
+ * fi：已打开文件信息，未打开时为NULL
  **/
-int gridfs_getattr(const char *path, struct stat *stbuf)
+int gridfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
 {
 	
 	/*
@@ -101,7 +548,7 @@ int gridfs_getattr(const char *path, struct stat *stbuf)
 			/*
 		 	 * 从连接池中获取一mongodb连接
 		 	 */
-    		ScopedDbConnection sdc(gridfs_options.host);
+    		PooledConnection sdc(meta_pool);
     		DBClientBase &conn = sdc.conn();
 			#ifdef DEBUG
 				printf("[GETATTR]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
@@ -128,25 +575,35 @@ int gridfs_getattr(const char *path, struct stat *stbuf)
     }
 
 	/*
-	 * 在已打开文件中找到相应的文件
+	 * 由文件句柄或在已打开文件中找到相应的文件
 	 */
-    boost::unordered_map<string,LocalGridFile*>::const_iterator file_iter;
-    file_iter = open_files.find(path);
-    if(file_iter != open_files.end()) {
-        stbuf->st_mode = S_IFREG | file_mode_s[path];
+    OpenFile *handle = fi ? open_file_of(fi) : NULL;
+    OpenFile *open_file = handle ? handle : open_files.acquire(path);
+    if(open_file) {
+        {
+        LocalGridFile *open_lgf = open_file->lgf;
+        boost::mutex::scoped_lock lock(open_lgf->getMutex());
+        stbuf->st_mode = S_IFREG | open_file->mode;
         stbuf->st_nlink = 1;//设置文件的连接数为1
         stbuf->st_ctime = time(NULL);//设置文件状态改变时间为当前时间
         stbuf->st_mtime = time(NULL);//设置文件最后被修改时间为当前时间
 		stbuf->st_atime = time(NULL);//设置文件最近存取时间
-        stbuf->st_size = file_iter->second->getLength();//设置文件的字节大小
+        stbuf->st_size = open_lgf->getLength();//设置文件的字节大小
+		stbuf->st_blksize = open_lgf->getChunkSize();//块大小，应用程序据此确定I/O大小
+		stbuf->st_blocks = (stbuf->st_size + 511) / 512;
+        }
+        if(!handle) {
+            put_open_file(open_file);
+        }
         return 0;//<--成功返回
     }
 
+	wait_flush(path);//已关闭但尚未写入GridFS的文件
 	try{
 		/*
 		 * 从连接池中获取一mongodb连接
 		 */
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
     	DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
 			printf("[GETATTR]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
@@ -156,69 +613,47 @@ int gridfs_getattr(const char *path, struct stat *stbuf)
     	 * 获取节点元信息
     	 */
 		//boost::recursive_mutex::scoped_lock lock(getattr_io_mutex);
-		BSONObj metedata_res = conn.findOne(db_name + ".fs.nodes",
-                                      		BSON("abs_path" << path));
-		if(!metedata_res.isEmpty()){
-			int type = metedata_res.getIntField("type");
-			BSONObj metedata_obj = metedata_res.getObjectField("meta_data");
-			if(type==1){
-				//目录
-				stbuf->st_mode = S_IFDIR | metedata_obj.getIntField("mode");
-				stbuf->st_nlink = metedata_obj.getIntField("nlink");
-				if(metedata_obj.getIntField("uid") >= 0){
-					stbuf->st_uid = metedata_obj.getIntField("uid");
-				}
-				if(metedata_obj.getIntField("gid") >= 0){
-					stbuf->st_gid = metedata_obj.getIntField("gid");
-				}
-				stbuf->st_atime = metedata_obj.getField("atime").Date().toTimeT();
-				stbuf->st_mtime = metedata_obj.getField("mtime").Date().toTimeT();
-				stbuf->st_ctime = metedata_obj.getField("ctime").Date().toTimeT();
-        		stbuf->st_size = 1024;//设置目录的字节大小
-				stbuf->st_blksize = BLOCK_SIZE;
-				stbuf->st_blocks = 1;
-				sdc.done();
-				return 0;//<---成功返回
-			}else if(type==0){
-				//文件
-				//获取文件id
-				OID file_id = metedata_obj.getField("file_id").OID();
-				BSONObj file_obj = conn.findOne(db_name + ".fs.files",
-                                      						BSON("_id" << file_id));
-				if(!file_obj.isEmpty()){
-        			stbuf->st_mode = S_IFREG | metedata_obj.getIntField("mode");//设置文件模式为一般文件且权限为666（rw-rw-rw-)
-        			stbuf->st_nlink = metedata_obj.getIntField("nlink");//设置文件的连接数为1
-					if(metedata_obj.getIntField("uid") >= 0){
-						stbuf->st_uid = metedata_obj.getIntField("uid");
-					}
-					if(metedata_obj.getIntField("gid") >= 0){
-						stbuf->st_gid = metedata_obj.getIntField("gid");
-					}
-					stbuf->st_atime = metedata_obj.getField("atime").Date().toTimeT();
-        			stbuf->st_ctime = file_obj.getField("uploadDate").Date().toTimeT();
-        			stbuf->st_mtime = metedata_obj.getField("mtime").Date().toTimeT();
-        			stbuf->st_size = file_obj.getIntField("length");//设置文件的字节大小
-					stbuf->st_blksize = BLOCK_SIZE;
-					stbuf->st_blocks = file_obj.getIntField("chunkSize")/BLOCK_SIZE;
-					sdc.done();
-        			return 0;//<--成功返回
-				}else{
-					sdc.done();
-					return -ENOENT;//<--没有相应的文件或文件夹
-				}	
-			}	
-		}else{
-			sdc.done();
-			return -ENOENT;//<--没有相应的文件或文件夹
-		}
-
+		BSONObj metedata_res, file_obj;
+		bool is_inline;
+		stat_node(conn,path,metedata_res,file_obj,is_inline);//节点及其文件文档只需一次往返
+		int res = node_stat(metedata_res,is_inline,file_obj,stbuf);
 		sdc.done();
+		return res;
 	}catch(DBException &e){
 		cout<<"[GETATTR]: Error = "<<e.what()<<endl;
 	}
     return 0;//<--成功返回
 }
 
+/**
+ * 增加一个目录项：readdirplus时目录及内联文件的属性直接由节点填写，
+ * GridFS文件（属性在fs.files中）及正在写入的文件仍由内核逐项lookup
+ * buf：缓冲区
+ * filler：填充目录项的函数
+ * path：目录路径
+ * child：目录项的节点文档
+ * flags：readdir的标志位
+ **/
+static void fill_dir_entry(void *buf, fuse_fill_dir_t filler, const char *path,
+						   const BSONObj& child, enum fuse_readdir_flags flags)
+{
+	const char *name = child.getStringField("name");
+	if(flags & FUSE_READDIR_PLUS){
+		BSONObj meta_data = child.getObjectField("meta_data");
+		bool is_inline = meta_data.hasField("inline");
+		string child_path = strcmp(path,"/") == 0 ? string("/") + name : string(path) + "/" + name;
+		if((child.getIntField("type") == 1 || is_inline) && !open_files.contains(child_path)){
+			struct stat st;
+			memset(&st, 0, sizeof(struct stat));
+			if(node_stat(child,is_inline,BSONObj(),&st) == 0){
+				filler(buf,name,&st,0,FUSE_FILL_DIR_PLUS);
+				return;
+			}
+		}
+	}
+	filler(buf,name,NULL,0,(fuse_fill_dir_flags)0);
+}
+
 /**
  * 读取目录内容
  * path：文件目录路径
@@ -226,21 +661,24 @@ int gridfs_getattr(const char *path, struct stat *stbuf)
  * filler：函数指针，其作用为在readdir函数中增加一个目录项，每次往buf中填充一个目录项实体的信息。
  * offset：偏移量
  * fi：已打开文件信息
+ * flags：FUSE_READDIR_PLUS时一并返回目录项的属性
  **/
 int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                   off_t offset, struct fuse_file_info *fi)
+                   off_t offset, struct fuse_file_info *fi,
+                   enum fuse_readdir_flags flags)
 {
 	#ifdef DEBUG
 	printf("[READDIR]: current path = \"%s\"\n",path);
 	#endif
-    filler(buf, ".", NULL, 0);//在当前目录下增加.目录
-    filler(buf, "..", NULL, 0);//在当前目录下增加..目录
+    wait_flush_dir(path);//直接子项中已关闭文件的长度等属性尚未写入时等待，不等待更深的子目录
+    filler(buf, ".", NULL, 0, (fuse_fill_dir_flags)0);//在当前目录下增加.目录
+    filler(buf, "..", NULL, 0, (fuse_fill_dir_flags)0);//在当前目录下增加..目录
 
 	try{
 		/*
 		 * 从连接池中获取一mongodb连接
 		 */
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
     	DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
 			printf("[READDIR]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
@@ -257,7 +695,7 @@ int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 			auto_ptr<DBClientCursor> get_children_id_c = conn.query(nodes_ns,get_children_id);
 			while(get_children_id_c->more()){
 				BSONObj child_obj = get_children_id_c->next();
-				filler(buf,child_obj.getStringField("name"),NULL,0);//在当前目录下增加孩子节点name目录
+				fill_dir_entry(buf,filler,path,child_obj,flags);//在当前目录下增加孩子节点name目录
 			}	
 		}else{
 			//非根目录
@@ -278,7 +716,7 @@ int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 				auto_ptr<DBClientCursor> get_children_id_c = conn.query(nodes_ns,get_children_id);
 				while(get_children_id_c->more()){
 					BSONObj child_obj = get_children_id_c->next();
-					filler(buf,child_obj.getStringField("name"),NULL,0);//在当前目录下增加孩子节点name目录
+					fill_dir_entry(buf,filler,path,child_obj,flags);//在当前目录下增加孩子节点name目录
 				}			
 			}else{
 				sdc.done();
@@ -315,7 +753,7 @@ int gridfs_access(const char *path, int amode)
 			/*
 		 	* 从连接池中获取一mongodb连接
 		 	*/
-        	ScopedDbConnection sdc(gridfs_options.host);
+        	PooledConnection sdc(meta_pool);
 			#ifdef DEBUG
 				printf("[ACCESS]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
 			#endif
@@ -354,6 +792,168 @@ int gridfs_access(const char *path, int amode)
 	return 0;
 }
 
+/**
+ * 文件节点对应的fs.files文档：按节点中的file_id查找（克隆的文件共用同一文档），
+ * 节点中没有file_id时按文件名查找
+ * meta_data：文件节点元信息
+ * name：文件名
+ **/
+static BSONObj find_file_doc(DBClientBase& conn, const BSONObj& meta_data, const char *name)
+{
+	string files_ns = string(gridfs_options.db)+string(".fs.files");//文件命名空间
+	if(meta_data.getField("file_id").type() == jstOID){
+		return conn.findOne(files_ns,BSON("_id" << meta_data.getField("file_id")));
+	}
+	return conn.findOne(files_ns,BSON("filename" << name));
+}
+
+/**
+ * 为已存在的文件构造本地缓存：内联存储的小文件载入数据，GridFS文件以原文件为底按需取回块
+ * path：文件路径
+ * meta_data：文件节点元信息
+ * trunc：是否丢弃原有内容
+ * lgf：返回构造的本地缓存
+ **/
+static int load_local_gridfile(DBClientBase& conn, const char *path, const BSONObj& meta_data,
+                               bool trunc, LocalGridFile*& lgf)
+{
+	if(meta_data.hasField("inline")){
+		//内联存储的小文件：数据载入新的本地缓存，flush时整体重写
+		lgf = new_local_gridfile(OID::gen(),chunk_size_for(conn,path));
+		if(!trunc){
+			int len = 0;
+			const char *data = meta_data.getField("inline").binData(len);
+			lgf->write(data,len,0);
+		}
+		return 0;
+	}
+
+	BSONObj file_obj = find_file_doc(conn,meta_data,fuse_to_mongo_path(path,false));
+
+	//检查GridFS的存在性
+	if(file_obj.isEmpty()){
+		if(meta_data.getField("file_id").type() != jstOID){
+			return -ENOENT;//<--没有相应的文件或文件夹
+		}
+		//已创建但尚未写入过的文件：沿用节点中的文件id，作为空文件重新写入
+		lgf = new_local_gridfile(meta_data.getField("file_id").OID(),chunk_size_for(conn,path));
+		return 0;
+	}
+	int chunk_size = file_obj.getIntField("chunkSize");//块大小
+	long long length = file_obj["length"].numberLong();//文件长度
+
+	if(trunc){
+		//以新文件id重写，原有文件在flush时删除；自适应时以原文件长度估计块大小
+		chunk_size = chunk_size_for(conn,path);
+		if(gridfs_options.adaptive_chunks && chunk_size == gridfs_options.chunk_size << 10){
+			chunk_size = adaptive_chunk_size(length,chunk_size);
+		}
+		lgf = new_local_gridfile(OID::gen(),chunk_size);
+	}else if(file_obj.getIntField("clones") > 0){
+		//与克隆共用的文件：在服务器端复制出独立的文件再修改，flush时释放对原文件的引用
+		OID file_id = OID::gen();
+		copy_chunks(conn,file_obj["_id"].OID(),file_id);
+		lgf = new_local_gridfile(file_id,chunk_size);
+		lgf->adopt(chunk_size,length);
+	}else{
+		//沿用原有文件id，只有被修改过的块在flush时写回
+		lgf = new_local_gridfile(file_obj["_id"].OID(),chunk_size,length);
+		lgf->flushed();
+	}
+	return 0;
+}
+
+/**
+ * 共用已打开文件的本地缓存，以O_TRUNC打开时截断（FUSE 3的atomic_o_trunc下内核不再另行截断）
+ * file：已打开文件，失败时归还其引用
+ * fi：已打开文件信息
+ **/
+static int share_open_file(OpenFile* file, struct fuse_file_info *fi)
+{
+	if(fi->flags & O_TRUNC){
+		int res;
+		{
+		boost::mutex::scoped_lock lock(file->lgf->getMutex());
+		res = file->lgf->truncate(0);
+		}
+		if(res != 0){
+			put_open_file(file);
+			return res;
+		}
+	}
+	set_open_file(fi,file);//设置文件句柄
+	return 0;//<--成功返回
+}
+
+/**
+ * 以写方式打开已存在的文件：本地缓存以GridFS中的文件为底，按需取回块
+ * path：文件路径
+ * fi：已打开文件信息
+ * mask：所需的访问权限
+ **/
+static int open_for_write(const char *path, struct fuse_file_info *fi, int mask)
+{
+	//在已打开文件中找到相应的文件，与其他打开共用本地缓存
+	OpenFile *open_file = open_files.acquire(path);
+	if(open_file) {
+		return share_open_file(open_file,fi);
+	}
+
+	const char *name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
+	FileTable::Loading loading(open_files,path);//载入期间该文件不能被克隆
+
+	try{
+		/*
+		 * 从连接池中获取一mongodb连接
+		 */
+		PooledConnection sdc(meta_pool);
+		#ifdef DEBUG
+			printf("[OPEN]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
+		#endif
+		DBClientBase &conn = sdc.conn();
+		string db_name = gridfs_options.db;//获取数据库名
+		GridFS gf(conn, gridfs_options.db);
+
+		/*
+		 * 获取节点元信息
+		 */
+		BSONObj metedata_res = conn.findOne(db_name + ".fs.nodes",
+											BSON("abs_path" << path));
+		if(metedata_res.isEmpty()){
+			bool exists = gf.findFile(name).exists();
+			sdc.done();
+			return exists ? 0 : -ENOENT;
+		}
+		BSONObj metedata_obj = metedata_res.getObjectField("meta_data");
+		if((metedata_obj.getIntField("mode") & mask) != mask){
+			sdc.done();
+			return -EACCES;
+		}
+
+		LocalGridFile *lgf;
+		int res = load_local_gridfile(conn,path,metedata_obj,fi->flags & O_TRUNC,lgf);
+		if(res != 0){
+			sdc.done();
+			return res;
+		}
+		sdc.done();
+
+		//其他线程已同时打开该文件时共用其本地缓存
+		OpenFile *file = open_files.open(path,lgf,metedata_obj.getIntField("mode"));
+		if(file->lgf != lgf){
+			delete lgf;
+			return share_open_file(file,fi);
+		}
+
+		set_open_file(fi,file);//设置文件句柄
+		return 0;//<--成功返回
+	}catch(DBException &e){
+		cout<<"[OPEN]: Error = "<<e.what()<<endl;
+	}
+
+	return -ENOENT;//<--没有相应的文件或文件夹
+}
+
 /**
  * 打开文件
  * path：文件路径
@@ -361,6 +961,12 @@ int gridfs_access(const char *path, int amode)
  **/
 int gridfs_open(const char *path, struct fuse_file_info *fi)
 {
+	wait_flush(path);//等待该文件此前的关闭写入完成
+	//此前关闭后的后台写入失败时，由这次打开返回错误
+	int err = take_flush_error(path);
+	if(err != 0){
+		return err;
+	}
 	/*
 	 * 判断文件访问模式
 	 */
@@ -369,8 +975,10 @@ int gridfs_open(const char *path, struct fuse_file_info *fi)
 		#ifdef DEBUG
 			printf("[OPEN]: FILE READ ONLY\n");
 		#endif
-		//在已打开文件中找到相应的文件
-        if(open_files.find(path) != open_files.end()) {
+		//在已打开文件中找到相应的文件，读取其本地缓存
+        OpenFile *open_file = open_files.acquire(path);
+        if(open_file) {
+            set_open_file(fi,open_file);//设置文件句柄
             return 0;//<--成功返回
         }
 
@@ -380,24 +988,24 @@ int gridfs_open(const char *path, struct fuse_file_info *fi)
 			/*
 		 	* 从连接池中获取一mongodb连接
 		 	*/
-        	ScopedDbConnection sdc(gridfs_options.host);
+        	PooledConnection sdc(meta_pool);
 			#ifdef DEBUG
 				printf("[OPEN]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
 			#endif
 			DBClientBase &conn = sdc.conn();
 			string db_name = gridfs_options.db;//获取数据库名
         	GridFS gf(conn, gridfs_options.db);
-        	GridFile file = gf.findFile(name);//返回文件名为name的文件对象
+
+			/*
+    		 * 获取节点元信息
+    		 */
+			BSONObj metedata_res = conn.findOne(db_name + ".fs.nodes",
+                                      						BSON("abs_path" << path));
+			BSONObj metedata_obj = metedata_res.getObjectField("meta_data");
 		
-			//检查GridFS的存在性
-        	if(file.exists()) {
-				/*
-    			 * 获取节点元信息
-    			 */
-				BSONObj metedata_res = conn.findOne(db_name + ".fs.nodes",
-                                      							BSON("abs_path" << path));
+			//检查文件的存在性（内联存储的小文件没有GridFS文件）
+        	if(metedata_obj.hasField("inline") || !find_file_doc(conn,metedata_obj,name).isEmpty()) {
 				if(!metedata_res.isEmpty()){
-					BSONObj metedata_obj = metedata_res.getObjectField("meta_data");
 					if((metedata_obj.getIntField("mode") & RDONLY_MASK) != RDONLY_MASK){
 						sdc.done();
 						return -EACCES;
@@ -416,187 +1024,143 @@ int gridfs_open(const char *path, struct fuse_file_info *fi)
 		#ifdef DEBUG
 			printf("[OPEN]: FILE WRITE ONLY\n");
 		#endif
-		fi->fh = FH;//设置文件句柄
-		//在已打开文件中找到相应的文件
-        if(open_files.find(path) != open_files.end()) {
-            return 0;//<--成功返回
-        }
-
-		const char *name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
-
-		try{
-			/*
-		 	* 从连接池中获取一mongodb连接
-		 	*/
-        	ScopedDbConnection sdc(gridfs_options.host);
-			#ifdef DEBUG
-				printf("[OPEN]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
-			#endif
-			DBClientBase &conn = sdc.conn();
-			string db_name = gridfs_options.db;//获取数据库名
-        	GridFS gf(conn, gridfs_options.db);
-        	GridFile file = gf.findFile(name);//返回文件名为name的文件对象
-		
-			//检查GridFS的存在性
-        	if(file.exists()) {	
-				/*
-    			 * 获取节点元信息
-    			 */
-				BSONObj metedata_res = conn.findOne(db_name + ".fs.nodes",
-                                      							BSON("abs_path" << path));
-				if(!metedata_res.isEmpty()){
-					BSONObj metedata_obj = metedata_res.getObjectField("meta_data");
-					if((metedata_obj.getIntField("mode") & WRONLY_MASK) != WRONLY_MASK){
-						sdc.done();
-						return -EACCES;
-					}
-					{
-					boost::recursive_mutex::scoped_lock lock(map_io_mutex);
-					file_mode_s.insert(boost::unordered_map<string, mode_t>::value_type(path,metedata_obj.getIntField("mode")));
-
-					open_files.insert(boost::unordered_map<string, LocalGridFile*>::value_type(path,new LocalGridFile(DEFAULT_CHUNK_SIZE)));
-
-					fi->fh = FH++;//设置文件句柄
-					}
-            	}
-				sdc.done();
-				return 0;//<--成功返回
-        	}
-			sdc.done();
-		}catch(DBException &e){
-			cout<<"[OPEN]: Error = "<<e.what()<<endl;
-		}
-	
-		return -ENOENT;//<--没有相应的文件或文件夹
+		return open_for_write(path,fi,WRONLY_MASK);
 	}else if((fi->flags & O_ACCMODE) == O_RDWR){
 		//文件读写
 		#ifdef DEBUG
 			printf("[OPEN]: FILE READ AND WRITE\n");
 		#endif
-		//在已打开文件中找到相应的文件
-        if(open_files.find(path) != open_files.end()) {
-            return 0;//<--成功返回
-        }
-
-		const char *name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
-
-		try{
-			/*
-		 	* 从连接池中获取一mongodb连接
-		 	*/
-        	ScopedDbConnection sdc(gridfs_options.host);
-			#ifdef DEBUG
-				printf("[OPEN]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
-			#endif
-        	GridFS gf(sdc.conn(), gridfs_options.db);
-        	GridFile file = gf.findFile(name);//返回文件名为name的文件对象
-        	sdc.done();
-		
-			//检查GridFS的存在性
-        	if(file.exists()) {
-            	return 0;//<--成功返回
-        	}
-		}catch(DBException &e){
-			cout<<"[OPEN]: Error = "<<e.what()<<endl;
-		}
-
-		return -ENOENT;//<--没有相应的文件或文件夹
+		return open_for_write(path,fi,RDONLY_MASK | WRONLY_MASK);
 	}else{
         return -EACCES;//<--权限错误，拒绝访问
     }
 }
 
-/**
- * 创建并打开文件
- * path：文件路径
- * mode：文件模式
- * ffi：已打开文件信息
+/**
+ * 创建并打开文件：一次查询取回全部祖先目录，据此检查父目录权限并确定块大小，
+ * 随即插入节点并建立本地缓存及文件句柄（数据在flush时写入），省去mknod、getattr、open的往返
+ * path：文件路径
+ * mode：文件模式
+ * ffi：已打开文件信息
  **/
-
-//int gridfs_create(const char* path, mode_t mode, struct fuse_file_info* ffi)
-//{
-//	{
-//	boost::recursive_mutex::scoped_lock lock(map_io_mutex);
-//	if(strlen(path)>=MAX_PATH_SIZE){
-//		return -ENAMETOOLONG;
-//	}
-
-//	try{
+int gridfs_create(const char* path, mode_t mode, struct fuse_file_info* ffi)
+{
+	if(strlen(path)>=MAX_PATH_SIZE){
+		return -ENAMETOOLONG;
+	}
+
+	int chunk_size = gridfs_options.chunk_size << 10;//块大小
+	OID file_id = OID::gen();//文件id
+
+	//此前关闭后的后台写入失败（节点未能写入）时，由这次创建返回错误
+	wait_flush(path);
+	int err = take_flush_error(path);
+	if(err != 0){
+		return err;
+	}
+
+	try{
 		/*
 	 	 * 从连接池中获取一mongodb连接
 	 	 */
-//    	ScopedDbConnection sdc(gridfs_options.host);
-//		DBClientBase &conn = sdc.conn();
-//		string db_name = gridfs_options.db;//获取数据库名
-//		#ifdef DEBUG
-//			printf("[CREATE]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
-//		#endif
-//		string nodes_ns = string(gridfs_options.db)+string(".fs.nodes");//节点命名空间
-
-//		char delim = '/';
-//		const char *name = strrchr(path,delim);//获取目录名称
+    	PooledConnection sdc(meta_pool);
+		DBClientBase &conn = sdc.conn();
+		#ifdef DEBUG
+			printf("[CREATE]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
+		#endif
+		string nodes_ns = string(gridfs_options.db)+string(".fs.nodes");//节点命名空间
 
 		/* 
 		 * 获取父目录名称
 		 */
-//		string path_str(path);
-//		int length = strlen(path)-strlen(name);
-//		string parent_str = path_str.substr(0,length);
-//		#ifdef DEBUG
-//			printf("[CREATE]: PARENT = \"%s\"\n",parent_str.c_str());
-//		#endif
-
-//		if(parent_str == ""){
-			//根目录
-//			#ifdef DEBUG
-//				printf("[CREATE]: PARENT ABS PATH = /\n");
-//			#endif		
-//		}else{
-			//非根目录
-//			#ifdef DEBUG
-//				printf("[CREATE]: PARENT ABS PATH = \"%s\"\n",parent_str.c_str());
-//			#endif
-			
-//			BSONObj parent_id_res = conn.findOne(db_name + ".fs.nodes",
-//                                      				BSON("abs_path" << parent_str));
-//			if(!parent_id_res.isEmpty()){
-
-//				BSONObj meta_data_obj = parent_id_res.getObjectField("meta_data");
-//				if((meta_data_obj.getIntField("mode") & (EXEONLY_MASK | WRONLY_MASK)) != (EXEONLY_MASK | WRONLY_MASK)){
-//					sdc.done();
-//					return -EACCES;
-//				}
-//			}
-//		}
-		
-//		sdc.done();
-//	}catch(DBException &e){
-//		cout<<"[CREATE]: Error = "<<e.what()<<endl;
-//	}
+		string path_str(path);
+		string parent_str = path_str.substr(0,path_str.rfind('/'));
+		#ifdef DEBUG
+			printf("[CREATE]: PARENT = \"%s\"\n",parent_str.c_str());
+		#endif
 
-//	open_files.insert(boost::unordered_map<string, LocalGridFile*>::value_type(path,new LocalGridFile(DEFAULT_CHUNK_SIZE)));
+		//祖先目录由近及远
+		BSONObj fields = BSON("_id" << 1 << "abs_path" << 1 << "meta_data.mode" << 1 << "meta_data.chunk_size" << 1);
+		auto_ptr<DBClientCursor> cursor = conn.query(nodes_ns,
+				Query(BSON("abs_path" << BSON("$in" << ancestor_paths(path)))).sort("depth",-1),
+				0,0,&fields);
+		vector<BSONObj> dirs;
+		while(cursor->more()){
+			dirs.push_back(cursor->next().getOwned());
+		}
 
-//	file_mode_s.insert(boost::unordered_map<string, mode_t>::value_type(path,mode));
-
-//    ffi->fh = FH++;//设置文件句柄
-//	}
-
-//    return 0;//<--成功返回
-//}
+		bool parent_found = (parent_str == "");//根目录
+		OID parent_id(string("000000000000000000000000"));//父节点id
+		bool size_found = false;
+		for(vector<BSONObj>::iterator dir = dirs.begin(); dir != dirs.end(); dir++){
+			BSONObj meta_data_obj = dir->getObjectField("meta_data");
+			if(parent_str == dir->getStringField("abs_path")){
+				if((meta_data_obj.getIntField("mode") & (EXEONLY_MASK | WRONLY_MASK)) != (EXEONLY_MASK | WRONLY_MASK)){
+					sdc.done();
+					return -EACCES;
+				}
+				parent_found = true;
+				parent_id = dir->getField("_id").OID();
+			}
+			//最近的设置了块大小的目录
+			if(!size_found && meta_data_obj.hasField("chunk_size")){
+				chunk_size = meta_data_obj.getIntField("chunk_size");
+				size_found = true;
+			}
+		}
+		if(!parent_found){
+			sdc.done();
+			return -ENOENT;//<--没有相应的父目录
+		}
+
+		//节点随创建写入，文件在首次flush之前即可列出，且进程崩溃后仍留下空文件
+		BSONObj node = BSONObjBuilder().append("name",fuse_to_mongo_path(path,true)).
+										append("type",0).
+										append("depth",get_depth(path)).
+										append("abs_path",path).
+										append("parent_id",parent_id).
+										append("meta_data",BSONObjBuilder().
+												append("file_id",file_id).
+												append("mode",mode).
+												append("nlink",1).
+												append("uid", getuid()).
+												append("gid", getgid()).
+												appendTimeT("atime",time(NULL)).
+												appendTimeT("mtime",time(NULL)).
+												appendTimeT("ctime",time(NULL)).obj()).
+										obj();
+		conn.insert(nodes_ns,node,0,meta_write_concern());
+		sdc.done();
+	}catch(DBException &e){
+		cout<<"[CREATE]: Error = "<<e.what()<<endl;
+		return -EIO;
+	}
+
+	LocalGridFile *lgf = new_local_gridfile(file_id,chunk_size);
+	//其他线程已同时创建该文件时共用其本地缓存
+	OpenFile *file = open_files.open(path,lgf,mode);
+	if(file->lgf != lgf){
+		delete lgf;
+	}
+
+    set_open_file(ffi,file);//设置文件句柄
+
+    return 0;//<--成功返回
+}
 
 int gridfs_mknod(const char* path, mode_t mode, dev_t dev)
 {
-	{
-	boost::recursive_mutex::scoped_lock lock(map_io_mutex);
 	if(strlen(path)>=MAX_PATH_SIZE){
 		return -ENAMETOOLONG;
 	}
 
+	int chunk_size = gridfs_options.chunk_size << 10;//块大小
+
 	try{
 		/*
 	 	 * 从连接池中获取一mongodb连接
 	 	 */
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
 		DBClientBase &conn = sdc.conn();
 		string db_name = gridfs_options.db;//获取数据库名
 		#ifdef DEBUG
@@ -640,18 +1204,25 @@ int gridfs_mknod(const char* path, mode_t mode, dev_t dev)
 			}
 		}
 		
+		chunk_size = chunk_size_for(conn,path);//目录设置的块大小
 		sdc.done();
 	}catch(DBException &e){
 		cout<<"[MKNOD]: Error = "<<e.what()<<endl;
 	}
 
-	open_files.insert(boost::unordered_map<string, LocalGridFile*>::value_type(path,new LocalGridFile(DEFAULT_CHUNK_SIZE)));
-
-	file_mode_s.insert(boost::unordered_map<string, mode_t>::value_type(path,mode));
-
+	LocalGridFile *lgf = new_local_gridfile(OID::gen(),chunk_size);
+	//其他线程已同时创建该文件时不必重复写入
+	OpenFile *file = open_files.open(path,lgf,mode);
+	if(file->lgf != lgf){
+		delete lgf;
+		put_open_file(file);
+		return 0;//<--成功返回
 	}
 
-    return 0;//<--成功返回
+	//mknod不打开文件，立即写入空文件节点
+	int res = flush_file(path,lgf,mode);
+	put_open_file(file);
+    return res;
 }
 
 /**
@@ -669,16 +1240,8 @@ int gridfs_release(const char* path, struct fuse_file_info* ffi)
         return 0;//<--成功返回
     }
 
-	{
-	boost::recursive_mutex::scoped_lock lock(map_io_mutex);
-    delete open_files[path];//释放open_files[path]指针指向的内存
-
-	boost::unordered_map<string,LocalGridFile*>::iterator file_iter = open_files.find(path);
-    open_files.erase(file_iter);//删除键为path的元素
-
-	boost::unordered_map<string,mode_t>::iterator mode_iter = file_mode_s.find(path);
-	file_mode_s.erase(mode_iter);
-	}
+	//释放该次打开持有的引用，同一文件的其他打开不受影响
+	put_open_file(open_file_of(ffi));
 
     return 0;//<--成功返回
 }
@@ -689,13 +1252,15 @@ int gridfs_release(const char* path, struct fuse_file_info* ffi)
  **/
 int gridfs_unlink(const char* path) {
     
+	wait_flush(path);
+	take_flush_error(path);//文件已删除，不再报告其写入错误
 	const char* file_name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
 
 	try{
 		/*
 	 	* 从连接池中获取一mongodb连接
 	 	*/
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
 		DBClientBase &conn = sdc.conn();
 		string db_name = gridfs_options.db;//获取数据库名
 		string nodes_ns = string(gridfs_options.db)+string(".fs.nodes");//节点命名空间
@@ -743,14 +1308,18 @@ int gridfs_unlink(const char* path) {
 			}
 		}
 
-    	GridFS gf(conn, gridfs_options.db);
-   	 	gf.removeFile(file_name);//删除文件名为name的文件
+		//释放节点对应的文件（被克隆的文件只减少引用）
+		BSONObj node_obj = conn.findOne(nodes_ns,BSON("abs_path" << path));
+		BSONObj file_obj = find_file_doc(conn,node_obj.getObjectField("meta_data"),file_name);
+		if(!file_obj.isEmpty()){
+			release_file(conn, file_obj["_id"].OID());
+		}
 
 		/*
 	 	 * 删除文件节点
 	 	 */
 		Query delete_file(BSONObjBuilder().append("abs_path",path).obj());
-		conn.remove(nodes_ns,delete_file);
+		conn.remove(nodes_ns,delete_file,false,meta_write_concern());
 		#ifdef DEBUG
 			printf("[UNLINK]: DELETE \"%s\" OK\n",path);
 		#endif
@@ -762,6 +1331,39 @@ int gridfs_unlink(const char* path) {
     return 0;//<--成功返回
 }
 
+/**
+ * 读取一个块（由io线程池执行）
+ * conn：mongodb连接
+ * files_id：文件id
+ * n：块号
+ * buf：缓存读出的数据
+ * size：buf大小
+ * len：读出的字节数
+ **/
+static void fetch_chunk_op(DBClientBase& conn, OID files_id, int n, char* buf, int size, int* len)
+{
+	*len = fetch_chunk(conn,files_id,n,buf,size);
+}
+
+/*
+ * 从ChunkPool借出的块缓存（不清零），析构时归还；须在使用它的AsyncQuery之前定义，
+ * 以便查询完成后才归还
+ */
+struct PooledChunkBufs {
+	PooledChunkBufs(int chunk_size) : pool(ChunkPool::get(chunk_size)) {}
+	~PooledChunkBufs(){
+		for(vector<char*>::iterator b = bufs.begin(); b != bufs.end(); b++){
+			pool.release(*b);
+		}
+	}
+	char* alloc(){
+		bufs.push_back(pool.alloc());
+		return bufs.back();
+	}
+	ChunkPool& pool;
+	vector<char*> bufs;
+};
+
 /**
  * 读取数据（从已打开文件中）
  * path：文件路径
@@ -774,15 +1376,28 @@ int gridfs_read(const char *path, char *buf, size_t size, off_t offset,
                 struct fuse_file_info *fi)
 {
 	/*
-	 * 根据文件路径查找相应的文件
+	 * 由文件句柄取得已打开文件
 	 */
-    boost::unordered_map<string,LocalGridFile*>::const_iterator file_iter;
-    file_iter = open_files.find(path);
-    if(file_iter != open_files.end()) {
-        LocalGridFile *lgf = file_iter->second;//实例化LocalGridFile
-        return lgf->read(buf, size, offset);//读取偏移量为offset、大小为size的数据，并缓存于buf中
+    OpenFile *file = open_file_of(fi);
+    if(file) {
+        boost::mutex::scoped_lock lock(file->lgf->getMutex());
+        return file->lgf->read(buf, size, offset);//读取偏移量为offset、大小为size的数据，并缓存于buf中
     }
 
+	//只读打开之后其他进程以写方式打开了该文件
+	file = open_files.acquire(path);
+	if(file) {
+		int res;
+		{
+		boost::mutex::scoped_lock lock(file->lgf->getMutex());
+		res = file->lgf->read(buf, size, offset);
+		}
+		put_open_file(file);
+		return res;
+	}
+
+	wait_flush(path);
+
 	const char *name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
 
 	size_t len = 0;//初始化已读取数据长度为0
@@ -790,46 +1405,94 @@ int gridfs_read(const char *path, char *buf, size_t size, off_t offset,
 		/*
 	 	 * 从连接池中获取一mongodb连接
 	 	 */
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(data_pool);
 		DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
 			printf("[READ]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
 		#endif
-    	GridFS gf(conn, gridfs_options.db);//获取一GridFS实例
-    	GridFile file = gf.findFile(name);//返回文件名为path的文件对象
+
+		//内联存储的小文件直接由节点读取
+		BSONObj node_obj = conn.findOne(string(gridfs_options.db) + ".fs.nodes",
+										BSON("abs_path" << path));
+		BSONObj meta_data_obj = node_obj.getObjectField("meta_data");
+		if(meta_data_obj.hasField("inline")){
+			int inline_len = 0;
+			const char *data = meta_data_obj.getField("inline").binData(inline_len);
+			if(offset < inline_len){
+				len = min((long long)size, (long long)(inline_len - offset));
+				memcpy(buf, data + offset, len);
+			}
+			sdc.done();
+			return len;
+		}
+
+    	BSONObj file_obj = find_file_doc(conn,meta_data_obj,name);//节点对应的文件
 
-		//检查文件的存在性
-   	 	if(!file.exists()) {
+		//检查文件的存在性，已创建但尚未写入过的文件为空文件
+   	 	if(file_obj.isEmpty()) {
         	sdc.done();//关闭数据库连接
-        	return -EBADF;//<--文件号错误
+        	return meta_data_obj.getField("file_id").type() == jstOID ? 0 : -EBADF;//<--文件号错误
     	}
 
-    	int chunk_size = file.getChunkSize();//获取文件块大小
-    	int chunk_num = offset / chunk_size;//获取偏移数据量所占的块数（作为欲读取数据的首个块号）
+    	int chunk_size = file_obj.getIntField("chunkSize");//获取文件块大小
+    	long long length = file_obj["length"].numberLong();//文件长度（64位）
+    	OID files_id = file_obj["_id"].OID();//文件id
 
-		//循环读取块数据		
-    	while(len < size && chunk_num < file.getNumChunks()) {
-        	GridFSChunk chunk = file.getChunk(chunk_num);//获取块号为chunk_num的块数据
-        	int to_read;
-        	int cl = chunk.len();//块数据的大小
+		//读取范围不超过文件末尾
+    	if(offset >= length) {
+        	sdc.done();
+        	return 0;
+    	}
+    	if((long long)size > length - offset) {
+        	size = length - offset;
+    	}
 
-        	const char *d = chunk.data(cl);//获取长度为c1的块数据首地址
+    	sdc.done();//各块并发读取，各占一个连接
 
-			//判断是否为首次读取数据
-       	 	if(len) {
-            	to_read = min((long unsigned)cl, (long unsigned)(size - len));
-            	memcpy(buf + len, d, to_read);
-        	} else {
-            	to_read = min((long unsigned)(cl - (offset % chunk_size)), (long unsigned)(size - len));//计算首次读取数据的大小
-            	memcpy(buf + len, d + (offset % chunk_size), to_read);//从d+(offset%chunk_size)所指地址处复制连续的to_read个字符到buf+len所指地址处。
-        	}
+		/*
+		 * 同时提交范围内各块的读取，再依次等待；
+		 * 整块落在读取范围内的直接读入buf，只有首尾的部分块借用缓存
+		 */
+		int first_chunk = offset / chunk_size;
+		int num_chunks = (offset + size - 1) / chunk_size - first_chunk + 1;
+		PooledChunkBufs pooled(chunk_size);
+		vector<char*> chunk_bufs(num_chunks);//块数据所在
+		vector<int> chunk_lens(num_chunks, 0);//块数据的大小
+		boost::ptr_vector<AsyncQuery> queries;
+		for(int i = 0; i < num_chunks; i++){
+			long long start = (long long)(first_chunk + i) * chunk_size;//块的起始位置
+			if(start >= offset && start + chunk_size <= offset + (long long)size){
+				chunk_bufs[i] = buf + (start - offset);
+			}else{
+				chunk_bufs[i] = pooled.alloc();
+			}
+			queries.push_back(new AsyncQuery(data_pool,boost::bind(fetch_chunk_op,_1,files_id,
+										first_chunk + i,chunk_bufs[i],chunk_size,&chunk_lens[i])));
+		}
+		for(int i = 0; i < num_chunks; i++){
+			queries[i].wait();
+		}
+
+		//复制块数据（缺失的块为空洞，以0填充）
+    	while(len < size) {
+        	long long pos = offset + len;//当前读取位置
+        	int chunk_num = pos / chunk_size;//当前块号
+        	int chunk_off = pos % chunk_size;//块内偏移
+        	int to_read = min((long long)(chunk_size - chunk_off), (long long)(size - len));
+
+        	int cl = chunk_lens[chunk_num - first_chunk];
+        	int avail = max(0, min(cl - chunk_off, to_read));
+        	char *src = chunk_bufs[chunk_num - first_chunk] + chunk_off;
+        	if(src != buf + len){
+        		memcpy(buf + len, src, avail);//直接读入buf的块已在原处
+        	}
+        	memset(buf + len + avail, 0, to_read - avail);//空洞及短块补0
 
         	len += to_read;//重新计算已读取数据长度
-        	chunk_num++;//块号递增
     	}
-    	sdc.done();
 	}catch(DBException &e){
 		cout<<"[READ]: Error = "<<e.what()<<endl;
+		return -EIO;//不能把未读到的部分当作已读取返回
 	}
 
     return len;//<--返回已读取数据大小
@@ -848,70 +1511,44 @@ int gridfs_write(const char* path, const char* buf, size_t nbyte,
                  off_t offset, struct fuse_file_info* ffi)
 {
 	/*
-	 * 根据文件路径查找相应的文件
+	 * 由文件句柄取得已打开文件
 	 */
-    if(open_files.find(path) == open_files.end()) {
-        return -ENOENT;//<--没有相应的文件或文件夹
+    OpenFile *file = open_file_of(ffi);
+    if(file == NULL) {
+        return -EBADF;//<--未以写方式打开
     }
 
-    LocalGridFile *lgf_t = open_files[path];//获取LocalGridFile
-
-    return lgf_t->write(buf, nbyte, offset);//写入数据
+    boost::mutex::scoped_lock lock(file->lgf->getMutex());//flush线程可能正在写入该文件
+    return file->lgf->write(buf, nbyte, offset);//写入数据
 }
 
 /**
- * 清除缓存数据
- * path：文件路径
- * ffi：已打开文件的信息
+ * 将已打开文件写入GridFS（由flush线程池或gridfs_flush调用）
+ * path_str：文件路径
+ * lgf：已打开文件
+ * mode：文件权限
  **/
-int gridfs_flush(const char* path, struct fuse_file_info *ffi)
+static int flush_file(const string& path_str, LocalGridFile* lgf, mode_t mode)
 {
-	{
-	boost::recursive_mutex::scoped_lock lock(flush_io_mutex);
+	boost::mutex::scoped_lock lock(lgf->getMutex());
 
+	const char *path = path_str.c_str();
     const char *name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
 	const char *file_name = fuse_to_mongo_path(path,true);//linux文件路径映射为节点名
 
-	//文件句柄为0
-	if(!ffi->fh){
-		return 0;
-	}
-
-	/*
-	 * 根据文件路径查找相应的文件
-	 */
-    boost::unordered_map<string,LocalGridFile*>::iterator file_iter;
-    file_iter = open_files.find(path);
-    if(file_iter == open_files.end()) {
-        return -ENOENT;//<--没有相应的文件或文件夹
-    }
-
-	/*
-	 * 根据文件路径查找相应的文件权限
-	 */
-    boost::unordered_map<string,mode_t>::iterator mode_iter;
-    mode_iter = file_mode_s.find(path);
-    if(mode_iter == file_mode_s.end()) {
-        return -EACCES;//<--相应文件权限错误
-    }
-
-    LocalGridFile *lgf = file_iter->second;//获取LocalGridFile对象
-
-	if(lgf!=NULL){
-	}else{
-		return -EFAULT;
-	}
-
-	if(lgf->getLength()==0){
-		return 0;
-	}
 	//文件已写入
     if(!lgf->dirty()) {
         return 0;//<--成功返回
     }
 
+	//先等待后台上传中的块写入完毕，上传线程需自行借用连接，不能在持有连接时等待
+	if(lgf->sync() != 0){
+		return -EIO;
+	}
+
+	bool is_inline = false;//是否内联存储
 	try{
-    	ScopedDbConnection sdc(gridfs_options.host);//从连接池中获取一mongodb连接
+    	PooledConnection sdc(data_pool);//从连接池中获取一mongodb连接
     	DBClientBase &conn = sdc.conn();//获取客户端
 		string db_name = gridfs_options.db;//获取数据库名
 		#ifdef DEBUG
@@ -921,22 +1558,60 @@ int gridfs_flush(const char* path, struct fuse_file_info *ffi)
 		//检查节点存在性
 		BSONObj node_obj = conn.findOne(db_name + ".fs.nodes",
                                       				BSON("abs_path" << path));
+
+		/*
+		 * 文件id在open/mknod时确定，只写入被修改过的块
+		 */
+		GridChunkBackend *backend = static_cast<GridChunkBackend*>(lgf->getBackend());
+		OID file_id = backend->getFilesId();
+
+		//自适应：尚未上传任何块时按最终长度重新划分块
+		if(gridfs_options.adaptive_chunks && lgf->getChunkSize() == gridfs_options.chunk_size << 10){
+			lgf->rechunk(adaptive_chunk_size(lgf->getLength(),lgf->getChunkSize()));
+		}
+
+		int chunk_size = lgf->getChunkSize();//获取块大小
+		long long len = lgf->getLength();//获取文件长度
+
+		//小文件（且尚未上传任何块）内联存储于节点的meta_data中，不写fs.files及fs.chunks
+		is_inline = gridfs_options.inline_max > 0 && len <= gridfs_options.inline_max &&
+					lgf->getStoredLength() == 0;
+		vector<char> inline_data(len);
+		if(is_inline){
+			if(len > 0){
+				lgf->read(&inline_data[0], len, 0);
+			}
+		}else{
+			int stored = store_dirty_chunks(conn, file_id, lgf);//只写入脏块
+			trim_chunks(conn, file_id, (len + chunk_size - 1) / chunk_size);//删除多余的块
+			//更新文件长度及校验和（非顺序写入时不写校验和）
+			StreamChecksum *checksum = lgf->getChecksum();
+			if(checksum != NULL){
+				store_file_doc(conn, file_id, name, chunk_size, len,
+							   checksum->field(), checksum->digest(len));
+			}else{
+				store_file_doc(conn, file_id, name, chunk_size, len);
+			}
+			#ifdef DEBUG
+				printf("[FLUSH]: %d DIRTY CHUNKS STORED\n",stored);
+			#endif
+		}
+
+		//文件数据所在：内联数据及长度，或GridFS文件id
+		BSONObjBuilder content;
+		if(is_inline){
+			content.appendBinData("inline",len,BinDataGeneral,inline_data.empty() ? "" : &inline_data[0]);
+			content.appendNumber("length",len);
+		}else{
+			content.append("file_id",file_id);
+		}
+		BSONObj content_obj = content.obj();
+
 		if(!node_obj.isEmpty()){
 			//节点存在
 			#ifdef DEBUG
 				printf("[FLUSH]: \"%s\" EXIST\n",path);
 			#endif
-    		GridFS gf(conn, gridfs_options.db);//获取一GridFS实例
-
-    		size_t len = lgf->getLength();//获取文件长度
-    		char *buf_t = new char[len];
-    		lgf->read(buf_t, len, 0);//从已打开文件中读出数据
-
-			gf.removeFile(file_name);
-   	 		BSONObj file_obj = gf.storeFile(buf_t, len, name);//向数据库写入文件
-			delete [] buf_t;
-			OID file_id = file_obj.getField("_id").OID();
-
 			/*
 			 * 获取文档键集合
 			 */
@@ -961,36 +1636,37 @@ int gridfs_flush(const char* path, struct fuse_file_info *ffi)
     		for(set<string>::iterator name = p_field_names.begin();
         		name != p_field_names.end(); name++)
     		{
-				//键不是"filename"
-      		  	if(*name != "file_id"){
+				//键不是"file_id"、"inline"、"length"
+      		  	if(*name != "file_id" && *name != "inline" && *name != "length"){
       		      	p.append(meta_data_obj.getField(*name));
        		 	}
    	 		}
 
-			p.append("file_id",file_id);
+			p.appendElements(content_obj);
 
     		b << "meta_data" << p.obj();//添加filename键。
 
     		conn.update(db_name + ".fs.nodes",
-                  		BSON("_id" << node_obj.getField("_id")), b.obj());//更新集合fs.files		
+                  		BSON("_id" << node_obj.getField("_id")), b.obj(),false,false,meta_write_concern());//更新集合fs.files		
+
+			//文件以新id重写或改为内联存储时释放原有文件，避免空洞处读到旧数据
+			BSONElement old_id = meta_data_obj.getField("file_id");
+			if(old_id.type() == jstOID && (is_inline || old_id.OID() != file_id)){
+				release_file(conn, old_id.OID());
+			}
 			sdc.done();
-			lgf->flushed();//文件写入
+			if(is_inline){
+				lgf->flushedInline();//文件写入节点
+			}else{
+				lgf->flushed();//文件写入
+			}
 			return 0;
 		}else{
 			//节点不存在，并创建
 			#ifdef DEBUG
 				printf("[FLUSH]: \"%s\" NOT EXIST\n",path);
 			#endif
-    		GridFS gf(conn, gridfs_options.db);//获取一GridFS实例
 
-    		size_t len = lgf->getLength();//获取文件长度
-    		char *buf_t = new char[len];
-    		lgf->read(buf_t, len, 0);//从已打开文件中读出数据
-
-   	 		BSONObj file_obj = gf.storeFile(buf_t, len, name);//向数据库写入文件
-			delete [] buf_t;
-			OID file_id = file_obj.getField("_id").OID();
-
 			/*
 			 * 计算父节点路径名
 			 */
@@ -1037,8 +1713,8 @@ int gridfs_flush(const char* path, struct fuse_file_info *ffi)
 											append("abs_path",path).
 											append("parent_id",parent_id).
 											append("meta_data",BSONObjBuilder().
-													append("file_id",file_id).
-													append("mode",file_mode_s[path]).
+													appendElements(content_obj).
+													append("mode",mode).
 													append("nlink",1).
 													append("uid", getuid()).
 													append("gid", getgid()).
@@ -1046,33 +1722,119 @@ int gridfs_flush(const char* path, struct fuse_file_info *ffi)
 													appendTimeT("mtime",time(NULL)).
 													appendTimeT("ctime",time(NULL)).obj()).
 											obj();
-			conn.insert(nodes_ns,node);
+			conn.insert(nodes_ns,node,0,meta_write_concern());
 		}
 
 		sdc.done();
 	}catch(DBException &e){
 		cout<<"[FLUSH]: Error = "<<e.what()<<endl;
+		return -EIO;
 	}  
 
-    lgf->flushed();//文件写入
+	if(is_inline){
+		lgf->flushedInline();//文件写入节点
+	}else{
+    	lgf->flushed();//文件写入
+	}
+    return 0;//<--成功返回
+}
+
+/**
+ * 清除缓存数据：有flush线程池时提交后台任务，同一文件的任务按顺序执行
+ * path：文件路径
+ * ffi：已打开文件的信息
+ **/
+int gridfs_flush(const char* path, struct fuse_file_info *ffi)
+{
+	//文件句柄为0
+	if(!ffi->fh){
+		return 0;
+	}
+
+	/*
+	 * 由文件句柄取得已打开文件及其权限
+	 */
+	OpenFile *file = open_file_of(ffi);
+	string key = open_files.path(file);
+	if(key.empty()){
+		return 0;//被重命名覆盖的文件已不在文件系统中，不再写回
+	}
+	if(flush_queue == NULL){
+		return flush_file(key,file->lgf,file->mode);
+	}
+
+	//与释放任务使用同一key（重命名后为新路径），任务完成前持有引用
+	open_files.hold(file);
+	flush_queue->post(key,boost::bind(flush_job,key,file));
+	if(gridfs_options.sync_close){
+		flush_queue->wait(key);
+		return take_flush_error(key.c_str());
 	}
     return 0;//<--成功返回
 }
+
+/**
+ * 将文件写入GridFS并等待完成
+ * path：文件路径
+ * datasync：仅同步数据
+ * ffi：已打开文件的信息
+ **/
+int gridfs_fsync(const char* path, int datasync, struct fuse_file_info *ffi)
+{
+	int res = gridfs_flush(path,ffi);
+	if(res != 0){
+		return res;
+	}
+
+	string key = ffi->fh ? open_files.path(open_file_of(ffi)) : string(path);
+	wait_flush(key.c_str());
+	return take_flush_error(key.c_str());
+}
+
+/**
+ * 等待目录下直接子项的后台flush完成
+ * path：目录路径
+ * datasync：仅同步数据
+ * ffi：已打开目录的信息
+ **/
+int gridfs_fsyncdir(const char* path, int datasync, struct fuse_file_info *ffi)
+{
+	wait_flush_dir(path);
+	return 0;
+}
 
 /**
  * 重命名
  * old_path：旧文件名
  * new_path：新文件名
+ * flags：RENAME_NOREPLACE、RENAME_EXCHANGE，不支持
  **/
-int gridfs_rename(const char* old_path, const char* new_path)
+int gridfs_rename(const char* old_path, const char* new_path, unsigned int flags)
 {
+	if(flags != 0){
+		return -EINVAL;
+	}
+
     const char *old_name = fuse_to_mongo_path(old_path,false);//linux文件路径映射为mongodb文件路径
     const char *new_name = fuse_to_mongo_path(new_path,false);//linux文件路径映射为mongodb文件路径
+
+	//已打开的文件可能尚未写入节点，先写回
+	OpenFile *open_file = open_files.acquire(old_path);
+	if(open_file){
+		int res = flush_file(old_path,open_file->lgf,open_file->mode);
+		put_open_file(open_file);
+		if(res != 0){
+			return res;
+		}
+	}
+	wait_flush(old_path);
+	wait_flush_dir(old_path,true);//重命名目录时其下各级文件的节点须已写入
+	wait_flush(new_path);
 	try{
 		/*
 	 	* 从连接池中获取一mongodb连接
 	 	*/
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
    	 	DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
 			printf("[RENAME]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
@@ -1094,26 +1856,10 @@ int gridfs_rename(const char* old_path, const char* new_path)
 
 		//检查文件的合法性
     	if(!file_obj.isEmpty()) {
-			/*
-			 * 获取文档键集合
-			 */
-    		BSONObjBuilder b;
-    		set<string> field_names;
-    		file_obj.getFieldNames(field_names);//将文档中的所有键存入field_names中
-			//过滤指定键
-    		for(set<string>::iterator name = field_names.begin();
-        		name != field_names.end(); name++)
-    		{
-				//键不是"filename"
-      		  	if(*name != "filename") {
-      		      	b.append(file_obj.getField(*name));
-       		 	}
-   	 		}
-
-    		b << "filename" << new_name;//添加filename键。
-
+			//只修改filename，不整体替换文档，以免覆盖并发修改的clones
     		conn.update(db_name + ".fs.files",
-                  		BSON("_id" << file_obj.getField("_id")), b.obj());//更新集合fs.files
+                  		BSON("_id" << file_obj.getField("_id")),
+						BSON("$set" << BSON("filename" << new_name)),false,false,meta_write_concern());//更新集合fs.files
 		}
 
 		//检查节点的合法性
@@ -1216,7 +1962,14 @@ int gridfs_rename(const char* old_path, const char* new_path)
 			r << "meta_data" << p.obj();
 
 			conn.update(db_name + ".fs.nodes",
-				 		BSON("_id" << node_obj.getField("_id")), r.obj());//更新集合fs.nodes
+				 		BSON("_id" << node_obj.getField("_id")), r.obj(),false,false,meta_write_concern());//更新集合fs.nodes
+
+			open_files.rename(old_path,new_path);//已打开的文件随之改名，此后的flush写入新路径
+			int err = take_flush_error(old_path);//关闭后写入失败的错误随之改名
+			if(err != 0){
+				boost::mutex::scoped_lock lock(flush_error_mutex);
+				flush_errors[new_path] = err;
+			}
 
 			//递归修改其子节点
 			Query get_children(BSONObjBuilder().append("parent_id",node_obj.getField("_id").OID()).obj());
@@ -1231,7 +1984,7 @@ int gridfs_rename(const char* old_path, const char* new_path)
 				char new_path_e[MAX_PATH_SIZE] = {0};
 				strcpy(new_path_e, new_path_t);
 				strcpy(old_path_e, old_path_t);
-				gridfs_rename((const char*)old_path_e, (const char*)new_path_e);		
+				gridfs_rename((const char*)old_path_e, (const char*)new_path_e, 0);		
 			}
 		}
 
@@ -1257,7 +2010,7 @@ int gridfs_mkdir(const char* path,mode_t mode)
 		/*
 		 * 从连接池中获取一mongodb连接
 		 */
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
 		DBClientBase &conn = sdc.conn();
 		string db_name = gridfs_options.db;//获取数据库名
 		#ifdef DEBUG
@@ -1360,7 +2113,7 @@ int gridfs_mkdir(const char* path,mode_t mode)
 					r << "meta_data" << p.obj();
 
 					conn.update(db_name + ".fs.nodes",
-				 		BSON("_id" << parent_id_res.getField("_id")), r.obj());//更新集合fs.nodes
+				 		BSON("_id" << parent_id_res.getField("_id")), r.obj(),false,false,meta_write_concern());//更新集合fs.nodes
 				}else{
 					sdc.done();
     				return -ENOENT;//<--没有相应的文件或文件夹		
@@ -1391,7 +2144,7 @@ int gridfs_mkdir(const char* path,mode_t mode)
 													appendTimeT("mtime",time(NULL)).
 													appendTimeT("ctime",time(NULL)).obj()).
 											obj();
-			conn.insert(nodes_ns,node);
+			conn.insert(nodes_ns,node,0,meta_write_concern());
 			}
 		}
 
@@ -1409,11 +2162,12 @@ int gridfs_mkdir(const char* path,mode_t mode)
  **/
 int gridfs_rmdir(const char* path)
 {
+	wait_flush_dir(path);
 	try{
 		/*
 	 	 * 从连接池中获取一mongodb连接
 	 	 */
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
 		DBClientBase &conn = sdc.conn();
 		string db_name = gridfs_options.db;//获取数据库名
 		#ifdef DEBUG
@@ -1494,7 +2248,7 @@ int gridfs_rmdir(const char* path)
 					r << "meta_data" << p.obj();
 
 					conn.update(db_name + ".fs.nodes",
-				 		BSON("_id" << parent_id_res.getField("_id")), r.obj());//更新集合fs.nodes
+				 		BSON("_id" << parent_id_res.getField("_id")), r.obj(),false,false,meta_write_concern());//更新集合fs.nodes
 				}else{
 					sdc.done();
     				return -ENOENT;//<--没有相应的文件或文件夹		
@@ -1506,7 +2260,7 @@ int gridfs_rmdir(const char* path)
 	 		* 删除目录节点
 	 		*/
 			Query delete_dir(BSONObjBuilder().append("abs_path",path).obj());
-			conn.remove(nodes_ns,delete_dir);
+			conn.remove(nodes_ns,delete_dir,false,meta_write_concern());
 			#ifdef DEBUG
 				printf("[RMDIR]: DELETE \"%s\" OK\n",path);
 			#endif
@@ -1528,83 +2282,388 @@ int gridfs_rmdir(const char* path)
 }
 
 /**
- * 将指定文件大小设置为length，若length小于原文件大小，超出部分被删掉
+ * 将指定文件大小设置为length：截短时删除超出部分的块并只重写边界块，加长时新增部分为空洞
  * path：文件名
  * length：大小
+ * fi：已打开文件信息（ftruncate），未打开时为NULL
  **/
-int gridfs_truncate(const char* path,off_t length)
+int gridfs_truncate(const char* path, off_t length, struct fuse_file_info* fi)
 {
-	const char* file_name = fuse_to_mongo_path(path,false);//linux文件路径映射为mongodb文件路径
+	if(length < 0){
+		return -EINVAL;
+	}
+
+	//由文件句柄截断已打开的文件
+	OpenFile *file = fi ? open_file_of(fi) : NULL;
+	if(file){
+		boost::mutex::scoped_lock lock(file->lgf->getMutex());
+		return file->lgf->truncate(length);
+	}
+
+	//已打开的文件直接截断本地缓存，关闭时写回
+	OpenFile *open_file = open_files.acquire(path);
+	if(open_file){
+		int res;
+		{
+		boost::mutex::scoped_lock lock(open_file->lgf->getMutex());
+		res = open_file->lgf->truncate(length);
+		}
+		put_open_file(open_file);
+		return res;
+	}
+
+	wait_flush(path);//等待该文件此前的关闭写入完成
+	FileTable::Loading loading(open_files,path);//截断期间该文件不能被克隆
 
 	try{
 		/*
 	 	* 从连接池中获取一mongodb连接
-	 	*/
-    	ScopedDbConnection sdc(gridfs_options.host);
+	 	*/
+    	PooledConnection sdc(data_pool);
 		DBClientBase &conn = sdc.conn();
 		string db_name = gridfs_options.db;//获取数据库名
-		string nodes_ns = string(gridfs_options.db)+string(".fs.nodes");//节点命名空间
 		#ifdef DEBUG
 			printf("[TRUNCATE]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
 		#endif
 
-		char delim = '/';
-		const char *name = strrchr(path,delim);//获取目录名称
-			
-		/* 
-		 * 获取父目录名称
+		/*
+		 * 获取节点元信息
 		 */
-		string path_str(path);
-		int length = strlen(path)-strlen(name);
-		string parent_str = path_str.substr(0,length);
+		BSONObj node_res = conn.findOne(db_name + ".fs.nodes",BSON("abs_path" << path));
+		if(node_res.isEmpty()){
+			sdc.done();
+			return -ENOENT;//<--没有相应的文件或文件夹
+		}
+		if(node_res.getIntField("type") == 1){
+			sdc.done();
+			return -EISDIR;
+		}
+		BSONObj meta_data_obj = node_res.getObjectField("meta_data");
+		if((meta_data_obj.getIntField("mode") & WRONLY_MASK) != WRONLY_MASK){
+			sdc.done();
+			return -EACCES;
+		}
+
+		//截为0时直接以空文件替换，否则沿用原文件并按需取回边界块
+		LocalGridFile *lgf;
+		int res = load_local_gridfile(conn,path,meta_data_obj,length == 0,lgf);
+		sdc.done();
+		if(res != 0){
+			return res;
+		}
+
+		res = lgf->truncate(length);
+		if(res == 0){
+			res = flush_file(path,lgf,meta_data_obj.getIntField("mode"));//写回边界块并更新文件长度
+		}
+		delete lgf;
 		#ifdef DEBUG
-			printf("[TRUNCATE]: PARENT = \"%s\"\n",parent_str.c_str());
+			printf("[TRUNCATE]: \"%s\" TO %lld\n",path,(long long)length);
 		#endif
+		return res;
+	}catch(DBException &e){
+		cout<<"[TRUNCATE]: Error = "<<e.what()<<endl;
+	}
+    return -EIO;
+}
 
-		if(parent_str == ""){
-			//根目录
-			#ifdef DEBUG
-				printf("[TRUNCATE]: PARENT ABS PATH = /\n");
-			#endif		
-		}else{
-			//非根目录
-			#ifdef DEBUG
-				printf("[TRUNCATE]: PARENT ABS PATH = \"%s\"\n",parent_str.c_str());
-			#endif
-			BSONObj parent_id_res = conn.findOne(db_name + ".fs.nodes",
-                                      				BSON("abs_path" << parent_str));
-			if(!parent_id_res.isEmpty()){
+/**
+ * 调用者能否读取节点（root总能读取）：按调用者与节点的uid、gid选用属主、属组或其他用户的读权限位
+ * meta_data：节点元信息
+ **/
+static bool caller_may_read(const BSONObj& meta_data)
+{
+	struct fuse_context *ctx = fuse_get_context();
+	if(ctx == NULL || ctx->uid == 0){
+		return true;
+	}
+	int mode = meta_data.getIntField("mode");
+	int uid = meta_data.getIntField("uid");
+	if(uid < 0 || (uid_t)uid == ctx->uid){
+		return (mode & RDONLY_MASK) != 0;
+	}
+	if((gid_t)meta_data.getIntField("gid") == ctx->gid){
+		return (mode & (RDONLY_MASK >> 3)) != 0;
+	}
+	return (mode & (RDONLY_MASK >> 6)) != 0;
+}
 
-				BSONObj meta_data_obj = parent_id_res.getObjectField("meta_data");
-				if((meta_data_obj.getIntField("mode") & (EXEONLY_MASK | WRONLY_MASK)) != (EXEONLY_MASK | WRONLY_MASK)){
-					sdc.done();
-					return -EACCES;
-				}
+/**
+ * 在服务器端把文件path_in的全部内容复制到文件path_out（数据不经过客户端）
+ * 目标文件已打开时须为空文件，复制后随关闭写回；未打开时复制后立即写回
+ * 返回复制的字节数，无法在服务器端复制时返回-EOPNOTSUPP
+ * path_in：源文件路径
+ * path_out：目标文件路径
+ * dst_lgf：已打开目标文件的本地缓存，未打开时为NULL
+ **/
+static ssize_t copy_into_lgf(const char* path_in, const char* path_out, LocalGridFile* dst_lgf)
+{
+	try{
+		string db_name = gridfs_options.db;//获取数据库名
 
+		/*
+		 * 并发获取源文件及目标文件节点
+		 */
+		BSONObj src_node, dst_node;
+		{
+		AsyncQuery src_query(meta_pool,find_one_op(db_name + ".fs.nodes",BSON("abs_path" << path_in),&src_node));
+		AsyncQuery dst_query(meta_pool,find_one_op(db_name + ".fs.nodes",BSON("abs_path" << path_out),&dst_node));
+		src_query.wait();
+		dst_query.wait();
+		}
+
+		/*
+	 	* 从连接池中获取一mongodb连接
+	 	*/
+    	PooledConnection sdc(data_pool);
+		DBClientBase &conn = sdc.conn();
+		#ifdef DEBUG
+			printf("[COPY]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
+		#endif
+
+		if(src_node.isEmpty() || (dst_node.isEmpty() && dst_lgf == NULL)){
+			sdc.done();
+			return -ENOENT;//<--没有相应的文件或文件夹
+		}
+		if(src_node.getIntField("type") == 1 || dst_node.getIntField("type") == 1){
+			sdc.done();
+			return -EISDIR;
+		}
+		BSONObj src_meta = src_node.getObjectField("meta_data");
+		if(!caller_may_read(src_meta)){
+			sdc.done();
+			return -EACCES;//<--不能读取源文件
+		}
+		if(!dst_node.isEmpty() &&
+		   (dst_node.getObjectField("meta_data").getIntField("mode") & WRONLY_MASK) != WRONLY_MASK){
+			sdc.done();
+			return -EACCES;
+		}
+
+		//未打开的目标文件使用临时的本地缓存
+		LocalGridFile *lgf = dst_lgf;
+		if(lgf == NULL){
+			lgf = new_local_gridfile(OID::gen(),chunk_size_for(conn,path_out));
+		}
+
+		ssize_t copied = -EOPNOTSUPP;
+		{
+		boost::mutex::scoped_lock lock(lgf->getMutex());
+		if(lgf->getLength() == 0){
+			if(src_meta.hasField("inline")){
+				//内联存储的小文件直接写入
+				int len = 0;
+				const char *data = src_meta.getField("inline").binData(len);
+				copied = lgf->write(data,len,0);
 			}else{
-				sdc.done();
-    			return -ENOENT;//<--没有相应的文件或文件夹		
+				BSONObj src_file = conn.findOne(db_name + ".fs.files",
+												BSON("_id" << src_meta.getField("file_id")));
+				if(src_file.isEmpty()){
+					copied = -ENOENT;
+				}else{
+					GridChunkBackend *backend = static_cast<GridChunkBackend*>(lgf->getBackend());
+					copy_chunks(conn,src_file["_id"].OID(),backend->getFilesId());
+					copied = src_file["length"].numberLong();
+					lgf->adopt(src_file.getIntField("chunkSize"),copied);
+				}
+			}
+		}
+		}
+		sdc.done();
+
+		//未打开的目标文件立即写回
+		if(dst_lgf == NULL){
+			if(copied >= 0){
+				int res = flush_file(path_out,lgf,dst_node.getObjectField("meta_data").getIntField("mode"));
+				if(res != 0){
+					copied = res;
+				}
 			}
+			delete lgf;
 		}
+		#ifdef DEBUG
+			printf("[COPY]: \"%s\" TO \"%s\" = %lld\n",path_in,path_out,(long long)copied);
+		#endif
+		return copied;
+	}catch(DBException &e){
+		cout<<"[COPY]: Error = "<<e.what()<<endl;
+	}
+	return -EIO;
+}
+
+/**
+ * 在服务器端把文件path_in的全部内容复制到文件path_out，见copy_into_lgf
+ * path_in：源文件路径
+ * path_out：目标文件路径
+ **/
+static ssize_t copy_into(const char* path_in, const char* path_out)
+{
+	//源文件正在写入时先写回
+	OpenFile *src_file = open_files.acquire(path_in);
+	if(src_file){
+		int res = flush_file(path_in,src_file->lgf,src_file->mode);
+		put_open_file(src_file);
+		if(res != 0){
+			return res;
+		}
+	}
+	wait_flush(path_in);
+	wait_flush(path_out);
+
+	//复制期间持有已打开目标文件的引用
+	OpenFile *dst_file = open_files.acquire(path_out);
+	ssize_t res = copy_into_lgf(path_in,path_out,dst_file ? dst_file->lgf : NULL);
+	if(dst_file){
+		put_open_file(dst_file);
+	}
+	return res;
+}
+
+/**
+ * 克隆文件的节点及文件文档部分，见clone_into，调用者已占用两个路径
+ * path_in：源文件路径
+ * path_out：目标文件路径（须已存在）
+ **/
+static int clone_nodes(const char* path_in, const char* path_out)
+{
+	try{
+		string nodes_ns = string(gridfs_options.db)+string(".fs.nodes");//节点命名空间
 
-    	GridFS gf(conn, gridfs_options.db);
-   	 	gf.removeFile(file_name);//删除文件名为name的文件
+		/*
+		 * 并发获取源文件及目标文件节点
+		 */
+		BSONObj src_node, dst_node;
+		{
+		AsyncQuery src_query(meta_pool,find_one_op(nodes_ns,BSON("abs_path" << path_in),&src_node));
+		AsyncQuery dst_query(meta_pool,find_one_op(nodes_ns,BSON("abs_path" << path_out),&dst_node));
+		src_query.wait();
+		dst_query.wait();
+		}
 
 		/*
-	 	 * 删除文件节点
-	 	 */
-		Query delete_file(BSONObjBuilder().append("abs_path",path).obj());
-		conn.remove(nodes_ns,delete_file);
+	 	* 从连接池中获取一mongodb连接
+	 	*/
+    	PooledConnection sdc(meta_pool);
+		DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
-			printf("[TRUNCATE]: DELETE \"%s\" OK\n",path);
+			printf("[CLONE]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
 		#endif
 
+		if(src_node.isEmpty() || dst_node.isEmpty()){
+			sdc.done();
+			return -ENOENT;//<--没有相应的文件或文件夹
+		}
+		if(src_node.getIntField("type") == 1 || dst_node.getIntField("type") == 1){
+			sdc.done();
+			return -EISDIR;
+		}
+		BSONObj src_meta = src_node.getObjectField("meta_data");
+		BSONObj dst_meta = dst_node.getObjectField("meta_data");
+		if(!caller_may_read(src_meta) || (dst_meta.getIntField("mode") & WRONLY_MASK) != WRONLY_MASK){
+			sdc.done();
+			return -EACCES;//<--不能读取源文件或写入目标文件
+		}
+
+		BSONObjBuilder set;
+		set.appendTimeT("meta_data.mtime",time(NULL));
+		BSONObj unset;
+		OID file_id;
+		if(src_meta.hasField("inline")){
+			//内联存储的小文件直接复制数据
+			set.appendAs(src_meta.getField("inline"),"meta_data.inline");
+			set.appendAs(src_meta.getField("length"),"meta_data.length");
+			unset = BSON("meta_data.file_id" << 1);
+		}else{
+			BSONObj src_file = find_file_doc(conn,src_meta,fuse_to_mongo_path(path_in,false));
+			if(src_file.isEmpty()){
+				sdc.done();
+				return -ENOENT;
+			}
+			file_id = src_file["_id"].OID();
+
+			//已是同一文件
+			BSONElement dst_id = dst_meta.getField("file_id");
+			if(dst_id.type() == jstOID && dst_id.OID() == file_id){
+				sdc.done();
+				return 0;
+			}
+
+			clone_file(conn,file_id);
+			set.append("meta_data.file_id",file_id);
+			unset = BSON("meta_data.inline" << 1 << "meta_data.length" << 1);
+		}
+		conn.update(nodes_ns,BSON("_id" << dst_node.getField("_id")),
+					BSON("$set" << set.obj() << "$unset" << unset),false,false,meta_write_concern());
+
+		//释放目标文件原有的内容
+		BSONElement old_id = dst_meta.getField("file_id");
+		if(old_id.type() == jstOID){
+			release_file(conn,old_id.OID());
+		}
 		sdc.done();
+		#ifdef DEBUG
+			printf("[CLONE]: \"%s\" TO \"%s\" OK\n",path_in,path_out);
+		#endif
 	}catch(DBException &e){
-		cout<<"[TRUNCATE]: Error = "<<e.what()<<endl;
-	}
-    return 0;//<--成功返回
+		cout<<"[CLONE]: Error = "<<e.what()<<endl;
+		return -EIO;
+	}
+	return 0;
+}
+
+/**
+ * 克隆文件：目标节点直接引用源文件的fs.files文档（clones加1），不复制任何块，
+ * 之后任一方以写方式打开时才在服务器端复制出独立的文件
+ * path_in：源文件路径
+ * path_out：目标文件路径（须已存在）
+ **/
+static int clone_into(const char* path_in, const char* path_out)
+{
+	//正在写入的文件不能共用；占用期间两个文件都不能以原有文件id写打开或截断
+	if(!open_files.block(path_in)){
+		return -EBUSY;
+	}
+	if(!open_files.block(path_out)){
+		open_files.unblock(path_in);
+		return -EBUSY;
+	}
+	wait_flush(path_in);
+	wait_flush(path_out);
+
+	int res = clone_nodes(path_in,path_out);
+
+	open_files.unblock(path_out);
+	open_files.unblock(path_in);
+	return res;
+}
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 4)
+/**
+ * 文件内复制：从头复制整个文件时在服务器端完成，其余情况由内核按读写复制
+ * path_in：源文件路径
+ * fi_in：源文件信息
+ * offset_in：源文件偏移量
+ * path_out：目标文件路径
+ * fi_out：目标文件信息
+ * offset_out：目标文件偏移量
+ * size：复制的字节数
+ * flags：标志位
+ **/
+ssize_t gridfs_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+							   const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+							   size_t size, int flags)
+{
+	if(offset_in != 0 || offset_out != 0){
+		return -EOPNOTSUPP;
+	}
+
+	struct stat st;
+	if(gridfs_getattr(path_in,&st,fi_in) != 0 || (off_t)size < st.st_size){
+		return -EOPNOTSUPP;//只复制部分内容
+	}
+	return copy_into(path_in,path_out);
 }
+#endif
 
 /**
  * 设置扩展属性
@@ -1617,21 +2676,147 @@ int gridfs_truncate(const char* path,off_t length)
 int gridfs_setxattr(const char* path, const char* name, const char* value, 
 					size_t size, int flags)
 {
-	return 0;}
+	//对文件设置复制（克隆）来源即在服务器端复制（共用）该文件的内容
+	if(strcmp(name,COPY_FROM_XATTR) == 0){
+		ssize_t res = copy_into(string(value,size).c_str(),path);
+		return res < 0 ? res : 0;
+	}
+	if(strcmp(name,CLONE_FROM_XATTR) == 0){
+		return clone_into(string(value,size).c_str(),path);
+	}
+
+	//另外只支持目录的块大小属性，其余属性忽略
+	if(strcmp(name,CHUNK_SIZE_XATTR) != 0){
+		return 0;
+	}
+
+	string value_str(value,size);
+	char *end;
+	long chunk_size = strtol(value_str.c_str(),&end,10);
+	if(value_str.empty() || *end != '\0' || chunk_size < 0 || chunk_size > (long)MAX_CHUNK_SIZE){
+		return -EINVAL;
+	}
+	if(chunk_size != 0 && (chunk_size < MIN_XATTR_CHUNK || chunk_size % MIN_XATTR_CHUNK != 0)){
+		return -EINVAL;//<--过小或未按页对齐的块大小
+	}
+
+	try{
+		/*
+	 	* 从连接池中获取一mongodb连接
+	 	*/
+    	PooledConnection sdc(meta_pool);
+   	 	DBClientBase &conn = sdc.conn();
+		#ifdef DEBUG
+			printf("[SETXATTR]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
+		#endif
+    	string db_name = gridfs_options.db;//获取数据库名
+
+   	 	BSONObj node_obj = conn.findOne(db_name + ".fs.nodes",
+                                      BSON("abs_path" << path));//查找节点
+   	 	if(node_obj.isEmpty()) {
+			sdc.done();
+    	    return -ENOENT;//<--没有相应的文件或文件夹
+   	 	}
+		if(node_obj.getIntField("type") != 1){
+			sdc.done();
+			return -ENOTDIR;//<--只能对目录设置
+		}
+
+		//0为取消设置，新文件沿用上级目录或挂载选项
+		BSONObj change = chunk_size == 0 ?
+						 BSON("$unset" << BSON("meta_data.chunk_size" << 1)) :
+						 BSON("$set" << BSON("meta_data.chunk_size" << (int)chunk_size));
+		conn.update(db_name + ".fs.nodes",BSON("_id" << node_obj.getField("_id")),change,
+					false,false,meta_write_concern());
+		sdc.done();
+	}catch(DBException &e){
+		cout<<"[SETXATTR]: Error = "<<e.what()<<endl;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * 按getxattr的约定返回属性值
+ * value_str：属性值
+ * value：缓存属性值
+ * size：value大小，0时只返回属性值长度
+ **/
+static int xattr_value(const string& value_str, char* value, size_t size)
+{
+	if(size == 0){
+		return value_str.size();
+	}
+	if(size < value_str.size()){
+		return -ERANGE;
+	}
+	memcpy(value,value_str.data(),value_str.size());
+	return value_str.size();
+}
+
+/**
+ * 读取扩展属性（目录的块大小，及连接池统计）
+ * path：文件路径
+ * name：属性名
+ * value：缓存属性值
+ * size：value大小，0时只返回属性值长度
+ **/
+int gridfs_getxattr(const char* path, const char* name, char* value, size_t size)
+{
+	string value_str;
+	if(strcmp(name,POOL_STATS_XATTR) == 0){
+		value_str = "meta " + meta_pool.stats() + "\ndata " + data_pool.stats();
+		return xattr_value(value_str,value,size);
+	}
+	if(strcmp(name,CHUNK_SIZE_XATTR) != 0){
+		return -ENODATA;
+	}
+
+	try{
+		/*
+	 	* 从连接池中获取一mongodb连接
+	 	*/
+    	PooledConnection sdc(meta_pool);
+   	 	DBClientBase &conn = sdc.conn();
+    	string db_name = gridfs_options.db;//获取数据库名
+
+   	 	BSONObj node_obj = conn.findOne(db_name + ".fs.nodes",
+                                      BSON("abs_path" << path));//查找节点
+		sdc.done();
+   	 	if(node_obj.isEmpty()) {
+    	    return -ENOENT;//<--没有相应的文件或文件夹
+   	 	}
+
+		BSONObj meta_data_obj = node_obj.getObjectField("meta_data");
+		if(!meta_data_obj.hasField("chunk_size")){
+			return -ENODATA;
+		}
+		char buf[16];
+		snprintf(buf,sizeof(buf),"%d",meta_data_obj.getIntField("chunk_size"));
+		value_str = buf;
+	}catch(DBException &e){
+		cout<<"[GETXATTR]: Error = "<<e.what()<<endl;
+		return -EIO;
+	}
+
+	return xattr_value(value_str,value,size);
+}
 
 /**
  * 更改用户/组
  * path:文件名
  * uid:用户id
  * gid：组id
+ * fi：已打开文件信息，未打开时为NULL
  **/
-int gridfs_chown(const char* path, uid_t uid, gid_t gid)
+int gridfs_chown(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fi)
 {
 	try{
 		/*
 	 	* 从连接池中获取一mongodb连接
 	 	*/
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
    	 	DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
 			printf("[CHOWN]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
@@ -1684,7 +2869,7 @@ int gridfs_chown(const char* path, uid_t uid, gid_t gid)
 			r << "meta_data" << p.obj();
 
 			conn.update(db_name + ".fs.nodes",
-				 		BSON("_id" << node_obj.getField("_id")), r.obj());//更新集合fs.nodes
+				 		BSON("_id" << node_obj.getField("_id")), r.obj(),false,false,meta_write_concern());//更新集合fs.nodes
 
 		}
 		
@@ -1700,14 +2885,15 @@ int gridfs_chown(const char* path, uid_t uid, gid_t gid)
  * 更改用户/组的权限
  * path:文件名
  * mode:权限
+ * fi：已打开文件信息，未打开时为NULL
  **/
-int gridfs_chmod(const char* path,mode_t mode)
+int gridfs_chmod(const char* path, mode_t mode, struct fuse_file_info* fi)
 {	
 	try{
 		/*
 	 	* 从连接池中获取一mongodb连接
 	 	*/
-    	ScopedDbConnection sdc(gridfs_options.host);
+    	PooledConnection sdc(meta_pool);
    	 	DBClientBase &conn = sdc.conn();
 		#ifdef DEBUG
 			printf("[CHMOD]: CONNECTED TO \"%s\" OK\n",gridfs_options.host);
@@ -1757,7 +2943,7 @@ int gridfs_chmod(const char* path,mode_t mode)
 			r << "meta_data" << p.obj();
 
 			conn.update(db_name + ".fs.nodes",
-				 		BSON("_id" << node_obj.getField("_id")), r.obj());//更新集合fs.nodes
+				 		BSON("_id" << node_obj.getField("_id")), r.obj(),false,false,meta_write_concern());//更新集合fs.nodes
 
 		}
 		
@@ -1773,8 +2959,9 @@ int gridfs_chmod(const char* path,mode_t mode)
  * 设定时间
  * path：文件名
  * ts:时间
+ * fi：已打开文件信息，未打开时为NULL
  **/
-int gridfs_utimens(const char *path, const struct timespec ts[2])
+int gridfs_utimens(const char *path, const struct timespec ts[2], struct fuse_file_info *fi)
 {
 	return 0;
 }
@@ -19,18 +19,21 @@
 #ifndef __OPERATIONS_H
 #define __OPERATIONS_H
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 31
 
 #include <fuse.h>
 
-int gridfs_getattr(const char *path, struct stat *stbuf);
+void* gridfs_init(struct fuse_conn_info* conn, struct fuse_config* cfg);
+
+int gridfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi);
 
 int gridfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                   off_t offset, struct fuse_file_info *fi);
+                   off_t offset, struct fuse_file_info *fi,
+                   enum fuse_readdir_flags flags);
 
 int gridfs_open(const char *path, struct fuse_file_info *fi);
 
-//int gridfs_create(const char* path, mode_t mode, struct fuse_file_info* ffi);
+int gridfs_create(const char* path, mode_t mode, struct fuse_file_info* ffi);
 
 int gridfs_mknod(const char* path, mode_t mode, dev_t dev);
 
@@ -42,9 +45,9 @@ int gridfs_read(const char *path, char *buf, size_t size, off_t offset,
 int gridfs_unlink(const char* path);
 /*
 int gridfs_listxattr(const char* path, char* list, size_t size);
+*/
+int gridfs_getxattr(const char* path, const char* name, char* value, size_t size);
 
-int gridfs_getxattr(const char* path, const char* name, char* value, size_t size);
-*/
 int gridfs_setxattr(const char* path, const char* name, const char* value,
                     size_t size, int flags);
 
@@ -52,8 +55,12 @@ int gridfs_write(const char* path, const char* buf, size_t nbyte,
                  off_t offset, struct fuse_file_info* ffi);
 
 int gridfs_flush(const char* path, struct fuse_file_info* ffi);
+
+int gridfs_fsync(const char* path, int datasync, struct fuse_file_info* ffi);
+
+int gridfs_fsyncdir(const char* path, int datasync, struct fuse_file_info* ffi);
 
-int gridfs_rename(const char* old_path, const char* new_path);
+int gridfs_rename(const char* old_path, const char* new_path, unsigned int flags);
 
 /*
  *function implements
@@ -71,25 +78,31 @@ int gridfs_rmdir(const char* path);
  *function implements
  *add truncate
  */
-int gridfs_truncate(const char* path,off_t length);
+int gridfs_truncate(const char* path, off_t length, struct fuse_file_info* fi);
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 4)
+ssize_t gridfs_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                               const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+                               size_t size, int flags);
+#endif
 
 /*
  *function implements
  *add chown
  */
-int gridfs_chown(const char* path, uid_t uid, gid_t gid);
+int gridfs_chown(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fi);
 
 /*
  *function implements
  *add chmod
  */
-int gridfs_chmod(const char* path,mode_t mode);
+int gridfs_chmod(const char* path, mode_t mode, struct fuse_file_info* fi);
 
 /*
  *function implements
  *add utimens
  */
-int gridfs_utimens(const char *path, const struct timespec ts[2]);
+int gridfs_utimens(const char *path, const struct timespec ts[2], struct fuse_file_info *fi);
 
 /*
  *function implements
@@ -27,6 +27,36 @@ struct fuse_opt gridfs_opts[] =
 {
     GRIDFS_OPT_KEY("--host=%s", host, 0),
     GRIDFS_OPT_KEY("--db=%s", db, 0),
+    GRIDFS_OPT_KEY("--upload_window=%d", upload_window, 0),
+    GRIDFS_OPT_KEY("--upload_threads=%d", upload_threads, 0),
+    GRIDFS_OPT_KEY("--write_budget=%d", write_budget, 0),
+    GRIDFS_OPT_KEY("--spill_dir=%s", spill_dir, 0),
+    GRIDFS_OPT_KEY("--flush_batch=%d", flush_batch, 0),
+    GRIDFS_OPT_KEY("--flush_threads=%d", flush_threads, 0),
+    GRIDFS_OPT_KEY("--sync_close", sync_close, 1),
+    GRIDFS_OPT_KEY("--checksum=%s", checksum, 0),
+    GRIDFS_OPT_KEY("--chunk_w=%s", chunk_w, 0),
+    GRIDFS_OPT_KEY("--chunk_j", chunk_j, 1),
+    GRIDFS_OPT_KEY("--chunk_wtimeout=%d", chunk_wtimeout, 0),
+    GRIDFS_OPT_KEY("--meta_w=%s", meta_w, 0),
+    GRIDFS_OPT_KEY("--meta_j", meta_j, 1),
+    GRIDFS_OPT_KEY("--meta_wtimeout=%d", meta_wtimeout, 0),
+    GRIDFS_OPT_KEY("--bulk_chunks", bulk_chunks, 1),
+    GRIDFS_OPT_KEY("--chunk_size=%d", chunk_size, 0),
+    GRIDFS_OPT_KEY("--adaptive_chunks", adaptive_chunks, 1),
+    GRIDFS_OPT_KEY("--inline_max=%d", inline_max, 0),
+    GRIDFS_OPT_KEY("--dedup", dedup, 1),
+    GRIDFS_OPT_KEY("--compress=%s", compress, 0),
+    GRIDFS_OPT_KEY("--pool_size=%d", pool_size, 0),
+    GRIDFS_OPT_KEY("--meta_pool_size=%d", meta_pool_size, 0),
+    GRIDFS_OPT_KEY("--data_ops=%d", data_ops, 0),
+    GRIDFS_OPT_KEY("--pool_prewarm=%d", pool_prewarm, 0),
+    GRIDFS_OPT_KEY("--sticky_conns", sticky_conns, 1),
+    GRIDFS_OPT_KEY("--io_threads=%d", io_threads, 0),
+    GRIDFS_OPT_KEY("--writeback_cache", writeback_cache, 1),
+    GRIDFS_OPT_KEY("--splice", splice, 1),
+    GRIDFS_OPT_KEY("--readdirplus", readdirplus, 1),
+    GRIDFS_OPT_KEY("--max_write=%d", max_write, 0),
     FUSE_OPT_KEY("-v", KEY_VERSION),
     FUSE_OPT_KEY("--version", KEY_VERSION),
     FUSE_OPT_KEY("-h", KEY_HELP),
@@ -56,10 +86,64 @@ void print_help()
     cout << endl << "general options:" << endl;
     cout << "\t--db=[dbname]\t\twhich mongo database to use" << endl;
     cout << "\t--host=[hostname]\thostname of your mongodb server" << endl;
+    cout << "\t--upload_window=[n]\tchunks of one file uploaded in the background" << endl;
+    cout << "\t\t\t\twhile it is written, 0 to upload on close (default 4)" << endl;
+    cout << "\t--upload_threads=[n]\tbackground upload threads (default 4)" << endl;
+    cout << "\t--write_budget=[MB]\tmemory for write buffers of all open files," << endl;
+    cout << "\t\t\t\t0 for no limit (default 1024)" << endl;
+    cout << "\t--spill_dir=[dir]\twhere buffers over the budget are kept, best on disk" << endl;
+    cout << "\t\t\t\trather than tmpfs (default /var/tmp);" << endl;
+    cout << "\t\t\t\twrites fail with ENOSPC once it is full" << endl;
+    cout << "\t--flush_batch=[n]\tchunks written per bulk upsert on flush (default 16)" << endl;
+    cout << "\t--flush_threads=[n]\tbackground threads uploading closed files," << endl;
+    cout << "\t\t\t\ta failed upload is logged and returned by the next" << endl;
+    cout << "\t\t\t\topen or fsync; 0 to upload inside close (default 4)" << endl;
+    cout << "\t--sync_close\t\tclose waits for the background upload" << endl;
+    cout << "\t--checksum=[type]\tfile checksum computed while writing:" << endl;
+    cout << "\t\t\t\tmd5, xxh3 or none (default md5)" << endl;
+    cout << "\t--chunk_w=[n|mode]\twrite concern w for chunk writes, 0 to not wait" << endl;
+    cout << "\t--chunk_j\t\twait for the journal on chunk writes" << endl;
+    cout << "\t--chunk_wtimeout=[ms]\twrite concern timeout for chunk writes" << endl;
+    cout << "\t--meta_w=[n|mode]\twrite concern w for file and node metadata" << endl;
+    cout << "\t--meta_j\t\twait for the journal on metadata writes" << endl;
+    cout << "\t--meta_wtimeout=[ms]\twrite concern timeout for metadata writes" << endl;
+    cout << "\t--bulk_chunks\t\tflush chunks as unordered bulk upserts; chunks" << endl;
+    cout << "\t\t\t\tstreamed during writes (--upload_window) are still" << endl;
+    cout << "\t\t\t\twritten one at a time" << endl;
+    cout << "\t--chunk_size=[KB]\tchunk size of new files (default 256); a directory's" << endl;
+    cout << "\t\t\t\tuser.gridfs.chunk_size xattr (bytes) overrides it" << endl;
+    cout << "\t--adaptive_chunks\tgrow the chunk size of large files to keep" << endl;
+    cout << "\t\t\t\tabout 1024 chunks per file (up to 4MB); files are then" << endl;
+    cout << "\t\t\t\tuploaded on close, as with --upload_window=0" << endl;
+    cout << "\t--inline_max=[bytes]\tfiles up to this size are stored only inside their" << endl;
+    cout << "\t\t\t\tnode document, not as GridFS files other clients can" << endl;
+    cout << "\t\t\t\tread (default 0, disabled)" << endl;
+    cout << "\t--dedup\t\t\tstore chunks once per content hash (SHA-256)" << endl;
+    cout << "\t--compress=[codec]\tcompress chunks with lz4, zstd or none" << endl;
+    cout << "\t\t\t\t(default none); incompressible chunks stay raw" << endl;
+    cout << "\t--pool_size=[n]\tmongodb connections moving chunk data at once," << endl;
+    cout << "\t\t\t\tfurther transfers wait (default 0, no limit)" << endl;
+    cout << "\t--meta_pool_size=[n]\tconnections for metadata operations (stat, ls...)," << endl;
+    cout << "\t\t\t\tkept apart from chunk transfers (default 0, no limit)" << endl;
+    cout << "\t--data_ops=[n]\t\tbackground reads and writes the kernel sends at once;" << endl;
+    cout << "\t\t\t\tworker threads beyond them stay free for stat, ls..." << endl;
+    cout << "\t\t\t\t(default 0, kernel default of 12)" << endl;
+    cout << "\t--pool_prewarm=[n]\tconnections opened at mount (default 0)" << endl;
+    cout << "\t--sticky_conns\t\teach thread keeps its own connection" << endl;
+    cout << "\t--io_threads=[n]\tthreads running independent queries at once, such" << endl;
+    cout << "\t\t\t\tas the chunks of one read, 0 to run them in turn (default 8)" << endl;
+    cout << "\t--writeback_cache\tlet the kernel cache and batch writes" << endl;
+    cout << "\t--splice\t\tmove request data through pipes instead of copying" << endl;
+    cout << "\t--readdirplus\t\treturn attributes of directories and inline files" << endl;
+    cout << "\t\t\t\twith readdir" << endl;
+    cout << "\t--max_write=[KB]\tlargest write request from the kernel (default 128)" << endl;
     cout << "\t-h, --help\t\tprint help" << endl;
     cout << "\t-v, --version\t\tprint version" << endl;
     cout << endl << "FUSE options: " << endl;
     cout << "\t-d, -o debug\t\tenable debug output (implies -f)" << endl;
     cout << "\t-f\t\t\tforeground operation" << endl;
     cout << "\t-s\t\t\tdisable multi-threaded operation" << endl;
+    cout << "\t-o clone_fd\t\tone /dev/fuse descriptor per worker thread" << endl;
+    cout << "\t-o max_idle_threads=[n]\tidle worker threads kept (default 10)" << endl;
+    cout << "\t-o max_threads=[n]\tworker thread limit (libfuse 3.12 and later)" << endl;
 }
@@ -19,12 +19,42 @@
 #ifndef __OPTIONS_H
 #define __OPTIONS_H
 
-#include <fuse/fuse_opt.h>
+#include <fuse_opt.h>
 #include <cstddef>
 
 struct gridfs_options {
     const char* host;
     const char* db;
+    int upload_window;
+    int upload_threads;
+    int write_budget;
+    const char* spill_dir;
+    int flush_batch;
+    int flush_threads;
+    int sync_close;
+    const char* checksum;
+    const char* chunk_w;
+    int chunk_j;
+    int chunk_wtimeout;
+    const char* meta_w;
+    int meta_j;
+    int meta_wtimeout;
+    int bulk_chunks;
+    int chunk_size;
+    int adaptive_chunks;
+    int inline_max;
+    int dedup;
+    const char* compress;
+    int pool_size;
+    int meta_pool_size;
+    int data_ops;
+    int pool_prewarm;
+    int sticky_conns;
+    int io_threads;
+    int writeback_cache;
+    int splice;
+    int readdirplus;
+    int max_write;
 };
 
 extern gridfs_options gridfs_options;
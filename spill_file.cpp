@@ -0,0 +1,136 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spill_file.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+string SpillFile::_dir = "/var/tmp";
+
+SpillFile::SpillFile(int chunkSize) :
+    _fd(-1), _chunkSize(chunkSize), _slots(0), _reserved(0)
+{
+    // mapping offsets have to be page aligned
+    long page = sysconf(_SC_PAGESIZE);
+    _stride = (chunkSize + page - 1) / page * page;
+
+    string path = _dir + "/gridfs-spill-XXXXXX";
+    vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+
+    _fd = mkstemp(&name[0]);
+    if(_fd < 0) {
+        cout << "[SPILL]: Error = " << strerror(errno) << endl;
+        return;
+    }
+    unlink(&name[0]);
+}
+
+SpillFile::~SpillFile()
+{
+    for(std::map<char*, int>::iterator i = _slotOf.begin();
+        i != _slotOf.end(); i++) {
+        munmap(i->first, _chunkSize);
+    }
+
+    if(_fd >= 0) {
+        close(_fd);
+    }
+}
+
+char* SpillFile::map()
+{
+    if(_fd < 0) {
+        return NULL;
+    }
+
+    int slot;
+    if(!_free.empty()) {
+        // the slot's blocks were handed back in unmap, allocate them again
+        slot = _free.back();
+        int err = posix_fallocate(_fd, (off_t)slot * _stride, _stride);
+        if(err != 0) {
+            cout << "[SPILL]: Error = " << strerror(err) << endl;
+            return NULL;
+        }
+        _free.pop_back();
+    } else {
+        if(_slots == _reserved && !reserve()) {
+            return NULL;
+        }
+        slot = _slots++;
+    }
+
+    void *chunk = mmap(NULL, _chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       _fd, (off_t)slot * _stride);
+    if(chunk == MAP_FAILED) {
+        cout << "[SPILL]: Error = " << strerror(errno) << endl;
+        _free.push_back(slot);
+        return NULL;
+    }
+
+    _slotOf[(char*)chunk] = slot;
+    return (char*)chunk;
+}
+
+// Grows the file by EXTENT slots, or by one if the disk is short of that.
+// The blocks are allocated up front, so storing into a mapped chunk cannot
+// fault on a full disk later.
+bool SpillFile::reserve()
+{
+    int extent = EXTENT;
+    while(true) {
+        int err = posix_fallocate(_fd, (off_t)_reserved * _stride,
+                                  (off_t)extent * _stride);
+        if(err == 0) {
+            _reserved += extent;
+            return true;
+        }
+        if(extent == 1) {
+            cout << "[SPILL]: Error = " << strerror(err) << endl;
+            return false;
+        }
+        extent = 1;
+    }
+}
+
+void SpillFile::unmap(char* chunk)
+{
+    std::map<char*, int>::iterator i = _slotOf.find(chunk);
+    if(i == _slotOf.end()) {
+        return;
+    }
+
+    munmap(chunk, _chunkSize);
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // give the disk space of a freed slot back until it is reused
+    fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              (off_t)i->second * _stride, _stride);
+#endif
+    _free.push_back(i->second);
+    _slotOf.erase(i);
+}
@@ -0,0 +1,53 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SPILL_FILE_H
+#define _SPILL_FILE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// An unlinked temp file that chunk buffers are moved to once the
+// mount-wide write budget is used up. Each chunk is a MAP_SHARED mapping
+// of its own slot, so the kernel can write it back and drop the pages.
+class SpillFile {
+public:
+    SpillFile(int chunkSize);
+    ~SpillFile();
+
+    // maps a free slot, returns NULL if the temp file is unusable or the
+    // disk has no room for another slot
+    char* map();
+    void unmap(char* chunk);
+
+    static void setDirectory(const char* dir) { _dir = dir; }
+
+private:
+    // slots the file grows by at once
+    enum { EXTENT = 16 };
+
+    bool reserve();
+
+    int _fd, _chunkSize, _stride, _slots, _reserved;
+    std::vector<int> _free;
+    std::map<char*, int> _slotOf;
+
+    static std::string _dir;
+};
+
+#endif
@@ -6,6 +6,9 @@ import subprocess
 import time
 import glob
 import stat
+import hashlib
+import errno
+import threading
 
 class BasicGridfsFUSETestCase(unittest.TestCase):
 
@@ -13,21 +16,47 @@ class BasicGridfsFUSETestCase(unittest.TestCase):
         self.mount = os.path.join(os.path.dirname(os.path.abspath(__file__)),
                                   'mount')
         os.mkdir('tests/mount')
-        subprocess.check_call(['./mount_gridfs', '--db=gridfstest',
-                               self.mount])
+        self.mount_gridfs()
+
+    def mount_gridfs(self, *options):
+        subprocess.check_call(['./mount_gridfs', '--db=gridfstest'] +
+                              list(options) + [self.mount])
 
         # wait for mount to complete
         time.sleep(1)
-            
-    def tearDown(self):
-        for filename in glob.iglob(os.path.join(self.mount, '*')):
-            os.remove(filename)
 
+    def umount_gridfs(self):
         if os.sys.platform == 'linux2':
-            subprocess.check_call(['fusermount', '-u', self.mount])
+            subprocess.check_call(['fusermount3', '-u', self.mount])
         else:
             subprocess.check_call(['umount', self.mount])
+            
+    def mount_or_skip(self, reason, *options):
+        # main rejects options for libraries the build lacks
+        try:
+            self.mount_gridfs(*options)
+        except subprocess.CalledProcessError:
+            self.mount_gridfs()
+            self.skipTest(reason)
+
+    def mongo_eval(self, script):
+        return subprocess.check_output(['mongo', '--quiet', 'gridfstest',
+                                        '--eval', script]).strip()
+
+    def file_chunks(self, name):
+        return int(self.mongo_eval(
+            'var node = db.fs.nodes.findOne({abs_path: "/%s"});'
+            'print(node ? db.fs.chunks.count({files_id: node.meta_data.file_id}) : 0)' % name))
+
+    def mount_pid(self):
+        return subprocess.check_output(['pgrep', '-f',
+                                        'mount_gridfs.*' + self.mount]).split()[0]
 
+    def tearDown(self):
+        for filename in glob.iglob(os.path.join(self.mount, '*')):
+            os.remove(filename)
+
+        self.umount_gridfs()
         os.rmdir(self.mount)
         
     def test_read_write(self):
@@ -146,6 +175,601 @@ class BasicGridfsFUSETestCase(unittest.TestCase):
 
         self.assertEquals(size2, os.stat(path).st_size)
 
+    def test_dirty_chunks(self):
+        path = os.path.join(self.mount, 'patched')
+        size = 4 * 256 * 1024
+        chunk = ('var node = db.fs.nodes.findOne({abs_path: "/patched"});'
+                 'var query = {files_id: node.meta_data.file_id, n: %d};')
+
+        # once flushed, only chunks written afterwards are stored again
+        with open(path, 'w') as w:
+            w.write('A' * size)
+            w.flush()
+            os.close(os.dup(w.fileno()))
+            while self.file_chunks('patched') < 4:
+                time.sleep(0.1)
+            for n in [0, 3]:
+                self.mongo_eval(chunk % n +
+                                'db.fs.chunks.update(query, {$set: {marker: 1}})')
+            w.seek(size - 1)
+            w.write('B')
+
+        with open(path, 'r') as r:
+            self.assertEquals('A' * (size - 1) + 'B', r.read())
+        for n, marked in [(0, 'true'), (3, 'false')]:
+            self.assertEquals(marked, self.mongo_eval(
+                chunk % n + 'print(db.fs.chunks.findOne(query).marker == 1)'))
+
+    def test_streamed_upload(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--upload_window=2')
+
+        # full chunks are stored while the file is still open
+        count = 'print(db.fs.chunks.count())'
+        before = int(self.mongo_eval(count))
+        data = os.urandom(8 * 256 * 1024 + 11)
+        path = os.path.join(self.mount, 'streamed')
+        with open(path, 'w+') as f:
+            f.write(data)
+            f.flush()
+            deadline = time.time() + 10
+            while int(self.mongo_eval(count)) - before < 8:
+                self.assertTrue(time.time() < deadline)
+                time.sleep(0.1)
+
+            # rewriting part of a stored chunk fetches it back first
+            f.seek(256 * 1024 + 10)
+            f.write('patch')
+            f.seek(0)
+            data = data[:256 * 1024 + 10] + 'patch' + data[256 * 1024 + 15:]
+            self.assertEquals(data, f.read())
+
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+    def test_write_budget(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--write_budget=1', '--upload_window=0')
+
+        # chunks past the budget live in an unlinked spill file
+        data = os.urandom(4 * 1024 * 1024 + 9)
+        path = os.path.join(self.mount, 'spilled')
+        with open(path, 'w+') as f:
+            f.write(data)
+            f.flush()
+            fd_dir = '/proc/%s/fd' % self.mount_pid()
+            spilled = False
+            for fd in os.listdir(fd_dir):
+                try:
+                    target = os.readlink(os.path.join(fd_dir, fd))
+                except OSError:
+                    continue
+                if 'gridfs-spill-' in target and target.endswith(' (deleted)'):
+                    spilled = True
+            self.assertTrue(spilled)
+            f.seek(0)
+            self.assertEquals(data, f.read())
+
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+    def test_recycled_buffers(self):
+        status = '/proc/%s/status' % self.mount_pid()
+        def rss_kb():
+            with open(status) as s:
+                for line in s:
+                    if line.startswith('VmRSS:'):
+                        return int(line.split()[1])
+
+        # buffers are reused across files instead of growing the daemon,
+        # and a reused buffer reads back as zeros where nothing was written
+        data = 'x' * (4 * 1024 * 1024)
+        for i in range(20):
+            if i == 5:
+                warm = rss_kb()
+            with open(os.path.join(self.mount, 'cycled'), 'w') as w:
+                w.write(data)
+            path = os.path.join(self.mount, 'gap')
+            with open(path, 'w') as w:
+                w.seek(100 + i)
+                w.write('y')
+            with open(path, 'r') as r:
+                self.assertEquals('\0' * (100 + i) + 'y', r.read())
+        self.assertTrue(rss_kb() - warm < 16 * 1024)
+
+    def test_sparse(self):
+        # only the two written chunks are stored, the hole reads as zeros
+        path = os.path.join(self.mount, 'sparse')
+        offset = 100 * 1024 * 1024
+        with open(path, 'w') as w:
+            w.write('head')
+            w.seek(offset)
+            w.write('tail')
+
+        with open(path, 'r') as r:
+            self.assertEquals('head', r.read(4))
+            r.seek(offset / 2)
+            self.assertEquals('\0' * (1024 * 1024), r.read(1024 * 1024))
+            r.seek(offset - 4)
+            self.assertEquals('\0' * 4 + 'tail', r.read())
+        self.assertEquals(offset + 4, os.stat(path).st_size)
+        self.assertEquals(2, self.file_chunks('sparse'))
+
+    def test_modify_in_place(self):
+        path = os.path.join(self.mount, 'big')
+        size = 256 * 1024 * 3 + 100
+        data = 'A' * size
+
+        with open(path, 'w') as w:
+            w.write(data)
+
+        with open(path, 'r+') as rw:
+            rw.seek(10)
+            rw.write('HEADER')
+            self.assertEquals('A' * 10, (rw.seek(0), rw.read(10))[1])
+
+        with open(path, 'a') as a:
+            a.write('tail')
+
+        expected = 'A' * 10 + 'HEADER' + 'A' * (size - 16) + 'tail'
+        with open(path, 'r') as r:
+            self.assertEquals(expected, r.read())
+
+        self.assertEquals(size + 4, os.stat(path).st_size)
+
+    def test_fsync(self):
+        path = os.path.join(self.mount, 'file')
+
+        with open(path, 'w') as w:
+            w.write('durable')
+            w.flush()
+            os.fsync(w.fileno())
+
+        fd = os.open(self.mount, os.O_RDONLY)
+        try:
+            os.fsync(fd)
+        finally:
+            os.close(fd)
+
+        self.assert_('file' in os.listdir(self.mount))
+        self.assertEquals(7, os.stat(path).st_size)
+
+    def test_checksum(self):
+        md5 = ('var node = db.fs.nodes.findOne({abs_path: "/%s"});'
+               'print(db.fs.files.findOne({_id: node.meta_data.file_id}).md5)')
+
+        # the md5 computed while writing matches the file contents
+        data = os.urandom(700 * 1024 + 3)
+        path = os.path.join(self.mount, 'summed')
+        with open(path, 'w') as w:
+            w.write(data)
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+        self.assertEquals(hashlib.md5(data).hexdigest(), self.mongo_eval(md5 % 'summed'))
+
+        # a file not written in order from the start gets no checksum
+        path = os.path.join(self.mount, 'unsummed')
+        with open(path, 'w') as w:
+            w.seek(64 * 1024)
+            w.write('late')
+            w.seek(0)
+            w.write('early')
+        with open(path, 'r') as r:
+            self.assertEquals('early', r.read(5))
+        self.assertEquals('undefined', self.mongo_eval(md5 % 'unsummed'))
+
+    def test_write_concerns(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--chunk_w=1', '--chunk_wtimeout=5000',
+                          '--meta_w=majority', '--bulk_chunks',
+                          '--flush_batch=4', '--upload_window=0')
+
+        # chunks go out as unordered bulk upserts, several batches per file
+        data = os.urandom(10 * 256 * 1024 + 1)
+        path = os.path.join(self.mount, 'acked')
+        with open(path, 'w') as w:
+            w.write(data)
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+        self.assertEquals(11, self.file_chunks('acked'))
+
+        # a standalone server cannot acknowledge w=3, and the error surfaces
+        self.umount_gridfs()
+        self.mount_gridfs('--chunk_w=3', '--upload_window=0')
+        fd = os.open(os.path.join(self.mount, 'unacked'), os.O_CREAT | os.O_WRONLY)
+        try:
+            os.write(fd, 'x' * (64 * 1024))
+            try:
+                os.fsync(fd)
+                self.fail('fsync succeeded without the requested write concern')
+            except OSError, e:
+                self.assertEquals(errno.EIO, e.errno)
+        finally:
+            try:
+                os.close(fd)
+            except OSError:
+                pass
+
+    def test_blksize(self):
+        path = os.path.join(self.mount, 'file')
+
+        with open(path, 'w') as w:
+            w.write('chunked')
+
+        self.assertEquals(256 * 1024, os.stat(path).st_blksize)
+
+        # a directory's chunk size must be whole pages
+        subdir = os.path.join(self.mount, 'sized')
+        os.mkdir(subdir)
+        for bad in ['1000', '5000']:
+            self.assertNotEquals(0, subprocess.call(
+                ['setfattr', '-n', 'user.gridfs.chunk_size', '-v', bad, subdir]))
+        subprocess.check_call(['setfattr', '-n', 'user.gridfs.chunk_size',
+                               '-v', str(64 * 1024), subdir])
+        with open(os.path.join(subdir, 'file'), 'w') as w:
+            w.write('chunked')
+        self.assertEquals(64 * 1024, os.stat(os.path.join(subdir, 'file')).st_blksize)
+        os.remove(os.path.join(subdir, 'file'))
+        os.rmdir(subdir)
+
+    def test_small_file_update(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--inline_max=16384')
+        path = os.path.join(self.mount, 'small')
+
+        with open(path, 'w') as w:
+            w.write('abc')
+
+        with open(path, 'a') as a:
+            a.write('def')
+
+        with open(path, 'r') as r:
+            self.assertEquals('abcdef', r.read())
+
+        self.assertEquals(6, os.stat(path).st_size)
+
+        # growing past the inline threshold moves the data to GridFS
+        data = 'x' * (64 * 1024)
+        with open(path, 'w') as w:
+            w.write(data)
+
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+    def test_empty_file_visible(self):
+        # without --inline_max even empty files get a GridFS file document
+        open(os.path.join(self.mount, 'created'), 'w').close()
+        os.mknod(os.path.join(self.mount, 'made'), 0644 | stat.S_IFREG)
+        for name in ['created', 'made']:
+            self.assertEquals('0', self.mongo_eval(
+                'var node = db.fs.nodes.findOne({abs_path: "/%s"});'
+                'print(Number(db.fs.files.findOne({_id: node.meta_data.file_id}).length))' % name))
+
+    def test_dedup(self):
+        self.umount_gridfs()
+        self.mount_or_skip('built without OpenSSL', '--dedup', '--chunk_size=64')
+
+        # both files share their chunks, as does the repeated block
+        data = ('a' * (64 * 1024)) * 3 + 'tail'
+        for name in ['copy1', 'copy2']:
+            with open(os.path.join(self.mount, name), 'w') as w:
+                w.write(data)
+
+        os.remove(os.path.join(self.mount, 'copy1'))
+
+        with open(os.path.join(self.mount, 'copy2'), 'r') as r:
+            self.assertEquals(data, r.read())
+
+        # overwriting one shared chunk leaves the others intact
+        with open(os.path.join(self.mount, 'copy2'), 'r+') as f:
+            f.seek(64 * 1024)
+            f.write('b' * (64 * 1024))
+
+        with open(os.path.join(self.mount, 'copy2'), 'r') as r:
+            self.assertEquals(data[:64 * 1024] + 'b' * (64 * 1024) +
+                              data[128 * 1024:], r.read())
+
+    def test_compress(self):
+        self.umount_gridfs()
+        self.mount_or_skip('built without LZ4', '--compress=lz4', '--chunk_size=64')
+
+        # a compressible chunk followed by ones that are stored raw
+        data = 'abcd' * (16 * 1024) + os.urandom(128 * 1024) + 'tail'
+        path = os.path.join(self.mount, 'packed')
+        with open(path, 'w') as w:
+            w.write(data)
+
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+    def test_truncate(self):
+        path = os.path.join(self.mount, 'trunc')
+        data = os.urandom(1024 * 1024 + 100)
+        with open(path, 'w') as w:
+            w.write(data)
+
+        # shrink into the middle of a chunk, then grow again with a hole
+        subprocess.check_call(['truncate', '-s', str(300 * 1024 + 7), path])
+        self.assertEquals(300 * 1024 + 7, os.stat(path).st_size)
+        with open(path, 'r') as r:
+            self.assertEquals(data[:300 * 1024 + 7], r.read())
+
+        with open(path, 'r+') as f:
+            f.truncate(600 * 1024)
+        with open(path, 'r') as r:
+            self.assertEquals(data[:300 * 1024 + 7] +
+                              '\0' * (300 * 1024 - 7), r.read())
+
+    def test_create(self):
+        for i in range(50):
+            with open(os.path.join(self.mount, 'new%d' % i), 'w') as w:
+                w.write(str(i))
+
+        for i in range(50):
+            path = os.path.join(self.mount, 'new%d' % i)
+            self.assertEquals(len(str(i)), os.stat(path).st_size)
+
+        self.assertRaises(OSError, os.open,
+                          os.path.join(self.mount, 'nodir', 'file'),
+                          os.O_CREAT | os.O_WRONLY)
+
+        # the node is stored on create, before anything is flushed
+        with open(os.path.join(self.mount, 'pending'), 'w') as w:
+            w.write('data')
+            self.assertEquals('1', self.mongo_eval(
+                'print(db.fs.nodes.count({abs_path: "/pending"}))'))
+            self.assertTrue('pending' in os.listdir(self.mount))
+        self.assertEquals(4, os.stat(os.path.join(self.mount, 'pending')).st_size)
+
+    def test_server_copy(self):
+        src = os.path.join(self.mount, 'src')
+        data = os.urandom(1024 * 1024 + 10)
+        with open(src, 'w') as w:
+            w.write(data)
+
+        subprocess.check_call(['./gridfs_cp', src,
+                               os.path.join(self.mount, 'dst')])
+        with open(os.path.join(self.mount, 'dst'), 'r') as r:
+            self.assertEquals(data, r.read())
+
+        # the copies are independent
+        with open(src, 'r+') as f:
+            f.write('changed')
+        with open(os.path.join(self.mount, 'dst'), 'r') as r:
+            self.assertEquals(data, r.read())
+
+    def test_clone(self):
+        src = os.path.join(self.mount, 'src')
+        clone = os.path.join(self.mount, 'clone')
+        data = os.urandom(1024 * 1024 + 10)
+        with open(src, 'w') as w:
+            w.write(data)
+
+        subprocess.check_call(['./gridfs_cp', '--reflink', src, clone])
+        with open(clone, 'r') as r:
+            self.assertEquals(data, r.read())
+
+        # writing to the clone leaves the source untouched, and removing
+        # the source leaves the clone intact
+        with open(clone, 'r+') as f:
+            f.write('changed')
+        with open(src, 'r') as r:
+            self.assertEquals(data, r.read())
+
+        os.remove(src)
+        with open(clone, 'r') as r:
+            self.assertEquals('changed' + data[7:], r.read())
+
+        # neither a copy nor a clone may expose a file the caller cannot read
+        if os.getuid() != 0:
+            secret = os.path.join(self.mount, 'secret')
+            with open(secret, 'w') as w:
+                w.write('hidden')
+            os.chmod(secret, 0200)
+            for flags in [[], ['--reflink']]:
+                self.assertNotEquals(0, subprocess.call(
+                    ['./gridfs_cp'] + flags + [secret, os.path.join(self.mount, 'leak')]))
+            with open(os.path.join(self.mount, 'leak'), 'r') as r:
+                self.assertEquals('', r.read())
+
+    def test_concurrent_opens(self):
+        path = os.path.join(self.mount, 'shared')
+        with open(path, 'w') as w:
+            w.write('a' * 10)
+
+        # closing the first handle must not drop the state the second
+        # handle is still writing through
+        first = open(path, 'r+')
+        second = open(path, 'r+')
+        first.write('b')
+        first.close()
+        second.seek(5)
+        second.write('c')
+        second.close()
+
+        with open(path, 'r') as r:
+            self.assertEquals('baaaacaaaa', r.read())
+
+        # O_TRUNC applies even when the file is already open elsewhere
+        first = open(path, 'r+')
+        first.write('d')
+        first.flush()
+        second = open(path, 'w')
+        self.assertEquals(0, os.stat(path).st_size)
+        second.write('new')
+        second.close()
+        first.close()
+
+        with open(path, 'r') as r:
+            self.assertEquals('new', r.read())
+
+    def test_rename_open(self):
+        # the open file follows the rename, and is written back under the new name
+        old_path = os.path.join(self.mount, 'before')
+        new_path = os.path.join(self.mount, 'after')
+        with open(old_path, 'w') as w:
+            w.write('first')
+            w.flush()
+            os.rename(old_path, new_path)
+            w.write(' second')
+
+        self.assertFalse(os.path.exists(old_path))
+        with open(new_path, 'r') as r:
+            self.assertEquals('first second', r.read())
+
+        # unlinking an open file keeps it readable until closed
+        with open(new_path, 'r+') as f:
+            os.unlink(new_path)
+            f.write('x')
+            f.seek(0)
+            self.assertEquals('xirst second', f.read())
+        self.assertFalse(os.path.exists(new_path))
+
+        # renaming onto an open file detaches it; closing it later must
+        # not write its data over the file renamed into its place
+        target = os.path.join(self.mount, 'target')
+        with open(old_path, 'w') as w:
+            w.write('moved')
+        with open(target, 'w') as t:
+            t.write('replaced')
+            t.flush()
+            os.rename(old_path, target)
+            t.write(' later')
+        with open(target, 'r') as r:
+            self.assertEquals('moved', r.read())
+
+    def test_conn_pool(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--pool_size=2', '--meta_pool_size=2',
+                          '--pool_prewarm=2', '--sticky_conns')
+
+        for i in range(20):
+            with open(os.path.join(self.mount, 'pooled%d' % i), 'w') as w:
+                w.write('x' * i)
+        self.assertEquals(20, len(os.listdir(self.mount)))
+
+        stats = subprocess.check_output(['getfattr', '--only-values', '-n',
+                                         'user.gridfs.pool_stats', self.mount])
+        self.assertTrue(stats.startswith('meta acquired='))
+        self.assertTrue('\ndata acquired=' in stats)
+
+    def test_data_ops(self):
+        for i in range(4):
+            with open(os.path.join(self.mount, 'bulk%d' % i), 'w') as w:
+                w.write(os.urandom(4 * 1024 * 1024))
+
+        self.umount_gridfs()
+        self.mount_gridfs('--data_ops=2', '--pool_size=2')
+
+        # lookups keep answering while reads fill the data slots
+        done = []
+        def reader(name):
+            while not done:
+                with open(os.path.join(self.mount, name), 'r') as r:
+                    while r.read(128 * 1024):
+                        pass
+        readers = [threading.Thread(target=reader, args=('bulk%d' % i,))
+                   for i in range(4)]
+        for t in readers:
+            t.start()
+        try:
+            time.sleep(1)
+            for i in range(20):
+                start = time.time()
+                self.assertFalse(os.path.exists(os.path.join(self.mount, 'missing%d' % i)))
+                self.assertTrue(time.time() - start < 2)
+        finally:
+            done.append(True)
+            for t in readers:
+                t.join()
+
+    def test_small_pool_close(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--pool_size=1', '--chunk_size=64', '--upload_window=2')
+
+        # background uploads need the only connection while close waits on them
+        data = os.urandom(1024 * 1024 + 3)
+        path = os.path.join(self.mount, 'single_conn')
+        with open(path, 'w') as w:
+            w.write(data)
+
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+    def test_parallel_read(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--chunk_size=16', '--io_threads=4')
+
+        # each read request spans several chunks, fetched concurrently
+        data = os.urandom(1024 * 1024 + 5)
+        path = os.path.join(self.mount, 'many_chunks')
+        with open(path, 'w') as w:
+            w.write(data)
+
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+            r.seek(40 * 1024 - 3)
+            self.assertEquals(data[40 * 1024 - 3:100 * 1024], r.read(60 * 1024 + 3))
+
+    def test_stat_lookup(self):
+        path = os.path.join(self.mount, 'stored')
+        with open(path, 'w') as w:
+            w.write('s' * (64 * 1024))
+        with open(path, 'r') as r:
+            r.read()
+
+        # remount so the kernel has no cached attributes, then profile one stat
+        self.umount_gridfs()
+        self.mount_gridfs()
+        self.mongo_eval('db.setProfilingLevel(0); db.system.profile.drop();'
+                        'db.setProfilingLevel(2)')
+        try:
+            self.assertEquals(64 * 1024, os.stat(path).st_size)
+        finally:
+            self.mongo_eval('db.setProfilingLevel(0)')
+
+        # one aggregate on fs.nodes fetches the file document with $lookup
+        self.assertNotEquals('0', self.mongo_eval(
+            'print(db.system.profile.count({ns: "gridfstest.fs.nodes",'
+            ' "command.aggregate": "fs.nodes"}))'))
+        self.assertEquals('0', self.mongo_eval(
+            'print(db.system.profile.count({ns: "gridfstest.fs.files"}))'))
+
+        try:
+            os.stat(os.path.join(self.mount, 'missing'))
+            self.fail('stat of a missing path succeeded')
+        except OSError, e:
+            self.assertEquals(errno.ENOENT, e.errno)
+
+    def test_fuse3_options(self):
+        self.umount_gridfs()
+        self.mount_gridfs('--writeback_cache', '--readdirplus',
+                          '--max_write=1024', '-o', 'clone_fd')
+
+        # small writes are batched by the kernel, partial overwrites
+        # read back the rest of the page
+        path = os.path.join(self.mount, 'cached')
+        data = os.urandom(2 * 1024 * 1024)
+        with open(path, 'w') as w:
+            for i in range(0, len(data), 100):
+                w.write(data[i:i + 100])
+        with open(path, 'r+') as f:
+            f.seek(4097)
+            f.write('xy')
+        data = data[:4097] + 'xy' + data[4099:]
+        with open(path, 'r') as r:
+            self.assertEquals(data, r.read())
+
+        os.mkdir(os.path.join(self.mount, 'subdir'))
+        with open(os.path.join(self.mount, 'small'), 'w') as w:
+            w.write('tiny')
+        self.assertEquals(sorted(['cached', 'small', 'subdir']),
+                          sorted(os.listdir(self.mount)))
+        self.assertTrue(stat.S_ISDIR(os.stat(os.path.join(self.mount, 'subdir')).st_mode))
+        self.assertEquals(4, os.stat(os.path.join(self.mount, 'small')).st_size)
+        self.assertEquals(len(data), os.stat(path).st_size)
+        os.rmdir(os.path.join(self.mount, 'subdir'))
+
 def suite():
     suite = unittest.TestSuite()
     suite.addTest(BasicGridfsFUSETestCase())
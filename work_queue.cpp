@@ -0,0 +1,151 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "work_queue.h"
+
+#include <boost/bind.hpp>
+
+using namespace std;
+
+WorkQueue::WorkQueue(int threads) : _stop(false)
+{
+	for(int i = 0; i < threads; i++){
+		_threads.create_thread(boost::bind(&WorkQueue::run, this));
+	}
+}
+
+WorkQueue::~WorkQueue()
+{
+	{
+	boost::mutex::scoped_lock lock(_mutex);
+	_stop = true;
+	}
+	_ready_cond.notify_all();
+	_threads.join_all();
+}
+
+/**
+ * 提交任务
+ * key：任务所属的串行队列
+ * task：任务
+ * limit：该key允许的最大未完成任务数，0为不限制
+ **/
+void WorkQueue::post(const string& key, boost::function<void()> task, int limit)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+
+	//未完成任务过多时阻塞提交者
+	while(limit > 0 && _strands.count(key) && (int)_strands[key].tasks.size() >= limit){
+		_done_cond.wait(lock);
+	}
+
+	Strand &strand = _strands[key];
+	strand.tasks.push_back(task);
+	//队列空闲时加入就绪队列
+	if(!strand.running && strand.tasks.size() == 1){
+		_ready.push_back(key);
+		_ready_cond.notify_one();
+	}
+}
+
+/**
+ * 等待某一key的全部任务完成
+ * key：任务所属的串行队列
+ **/
+void WorkQueue::wait(const string& key)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	while(_strands.count(key)){
+		_done_cond.wait(lock);
+	}
+}
+
+/**
+ * 等待以prefix开头的全部key的任务完成
+ * prefix：key前缀
+ **/
+void WorkQueue::waitPrefix(const string& prefix)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	while(true){
+		map<string, Strand>::iterator it = _strands.lower_bound(prefix);
+		if(it == _strands.end() || it->first.compare(0, prefix.size(), prefix) != 0){
+			return;
+		}
+		_done_cond.wait(lock);
+	}
+}
+
+/**
+ * 等待prefix下一级key（其余部分不含'/'）的任务完成，更深的key不等待
+ * prefix：key前缀
+ **/
+void WorkQueue::waitChildren(const string& prefix)
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	while(true){
+		bool pending = false;
+		for(map<string, Strand>::iterator it = _strands.lower_bound(prefix);
+			it != _strands.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++){
+			if(it->first.find('/', prefix.size()) == string::npos){
+				pending = true;
+				break;
+			}
+		}
+		if(!pending){
+			return;
+		}
+		_done_cond.wait(lock);
+	}
+}
+
+/**
+ * 工作线程：每次取出一个就绪key的队首任务执行
+ **/
+void WorkQueue::run()
+{
+	boost::mutex::scoped_lock lock(_mutex);
+	while(true){
+		while(_ready.empty() && !_stop){
+			_ready_cond.wait(lock);
+		}
+		if(_ready.empty()){
+			return;
+		}
+
+		string key = _ready.front();
+		_ready.pop_front();
+		Strand &strand = _strands[key];
+		boost::function<void()> task = strand.tasks.front();
+		strand.running = true;
+
+		lock.unlock();
+		task();
+		lock.lock();
+
+		//map中的元素地址不会因插入而改变
+		strand.tasks.pop_front();
+		strand.running = false;
+		if(strand.tasks.empty()){
+			_strands.erase(key);
+		}else{
+			_ready.push_back(key);
+			_ready_cond.notify_one();
+		}
+		_done_cond.notify_all();
+	}
+}
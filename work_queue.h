@@ -0,0 +1,69 @@
+/*
+ *  Copyright 2014 陈亚兴
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+#include <map>
+#include <deque>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/*
+ * 后台线程池：同一key的任务按提交顺序串行执行，不同key的任务并行执行
+ */
+class WorkQueue {
+public:
+    WorkQueue(int threads);
+    ~WorkQueue();
+
+    // 提交任务；limit>0时，该key未完成的任务数达到limit则阻塞等待
+    void post(const std::string& key, boost::function<void()> task,
+              int limit = 0);
+
+    // 等待该key此前提交的所有任务完成
+    void wait(const std::string& key);
+
+    // 等待所有以prefix开头的key此前提交的任务完成
+    void waitPrefix(const std::string& prefix);
+
+    // 只等待prefix下一级key（其余部分不含'/'）此前提交的任务完成
+    void waitChildren(const std::string& prefix);
+
+private:
+    struct Strand {
+        Strand() : running(false) {}
+        std::deque<boost::function<void()> > tasks;
+        bool running;
+    };
+
+    void run();
+
+    boost::mutex _mutex;
+    boost::condition_variable _ready_cond;
+    boost::condition_variable _done_cond;
+    std::map<std::string, Strand> _strands;
+    std::deque<std::string> _ready;
+    boost::thread_group _threads;
+    bool _stop;
+};
+
+#endif